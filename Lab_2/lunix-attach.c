@@ -2,11 +2,19 @@
  * lunix-attach.c
  *
  * Make the Lunix:TNG driver receive data from the specified
- * TTY, by attaching the Lunix line discipline to it.
+ * TTYs, by attaching the Lunix line discipline to them and
+ * reattaching it whenever one of them hangs up and comes back.
  *
  * Based on slattach.c for SLIP operation
  * [net-tools Debian package].
  *
+ * Alternatively, connect to a TCP endpoint and pump the received
+ * data straight into the Lunix:TNG injection device, with no
+ * socat and no pty in between.
+ *
+ * Either source can be recorded, with receive timestamps,
+ * into a capture file for lunix-replay.
+ *
  * Must be run with root privilege.
  *
  * Vangelis Koukis <vkoukis@cslab.ece.ntua.gr>
@@ -14,10 +22,12 @@
  */
 
 #include <pwd.h>
+#include <time.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdlib.h>          
@@ -28,10 +38,19 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <linux/serial.h>
+
 #include "lunix.h"
+#include "lunix-ldisc.h"
+#include "lunix-inject.h"
+#include "lunix-capture.h"
 
 #ifndef _PATH_LOCKD
 #define _PATH_LOCKD		"/var/lock"		/* lock files   */
@@ -63,17 +82,79 @@ struct {
 #endif
 #ifdef B115200
   { "115200",	B115200	},
+#endif
+#ifdef B230400
+  { "230400",	B230400	},
+#endif
+#ifdef B460800
+  { "460800",	B460800	},
+#endif
+#ifdef B500000
+  { "500000",	B500000	},
+#endif
+#ifdef B921600
+  { "921600",	B921600	},
+#endif
+#ifdef B1000000
+  { "1000000",	B1000000 },
 #endif
   { NULL,	0	}
 };
 
 /*
- * Global data
- *
+ * Serial line settings, overridable from the command line.
+ * The defaults are what the original sensor gateway expects.
+ */
+struct {
+	const char *speed;	/* bps, must be listed in tty_speeds[] */
+	const char *framing;	/* data bits, parity, stop bits, e.g. "8N1" */
+	int low_latency;	/* set ASYNC_LOW_LATENCY on the port */
+	int vmin;		/* VMIN/VTIME for raw reads [capture, measure] */
+	int vtime;
+} tty_params = { "57600", "8N1", 0, 1, 0 };
+
+/*
+ * TCP feeder parameters
  */
-int tty_fd = -1;
-struct termios tty_before, tty_current;
-int ldisc_before;
+#define TCP_BUFSZ		(64 * 1024)	/* bytes per read() from the socket */
+#define TCP_BACKOFF_MIN_MS	100		/* first reconnect delay */
+#define TCP_BACKOFF_MAX_MS	30000		/* reconnect delay ceiling */
+
+struct tcp_stats {
+	struct timespec start;		/* feeder start time */
+	unsigned long long bytes;	/* bytes forwarded to the driver */
+	unsigned long long reads;	/* successful socket reads */
+	unsigned long connects;		/* successful connections */
+	unsigned long failures;		/* failed connection attempts */
+	unsigned long disconnects;	/* connections lost after being established */
+};
+
+/*
+ * A TTY we manage, together with everything
+ * needed to restore it when we let go of it.
+ */
+struct tty_port {
+	char *name;			/* as given on the command line */
+	int fd;
+	struct termios before, current;
+	int ldisc_before;
+	int state_saved;		/* before, ldisc_before fetched: restore them */
+	struct serial_struct serial_before;
+	int serial_saved;
+	int lock_saved;
+	char lock_path[PATH_MAX];
+
+	/* Supervision of attached ports */
+	int attached;
+	uint64_t retry_at;		/* when to try reopening, usec */
+	unsigned int backoff_ms;
+	unsigned long reopens;
+	struct lunix_ldisc_stats last;	/* counters at the previous report */
+	uint64_t last_usec;
+};
+
+#define PORT_BACKOFF_MIN_MS	500	/* first reopen delay after a hangup */
+#define PORT_BACKOFF_MAX_MS	30000	/* reopen delay ceiling */
 
 /* Check for an existing lock file on our device */
 static int tty_already_locked(char *nam)
@@ -104,19 +185,26 @@ static int tty_already_locked(char *nam)
 	return 0;
 }
 
-/* Lock or unlock a terminal line. */
-static int tty_lock(char *path, int mode)
+/*
+ * Lock or unlock a terminal line. Slashes in path, e.g. for
+ * pts/3, are flattened so the lock file lives in _PATH_LOCKD.
+ */
+static int tty_lock(struct tty_port *port, char *path, int mode)
 {
 	int fd;
 	int ret;
 	char apid[16];
+	char *p;
 	struct passwd *pw;
-	static int saved_lock = 0;
-	static char saved_path[PATH_MAX];
+	int *saved_lock = &port->lock_saved;
+	char *saved_path = port->lock_path;
 
 	/* We do not lock standard input. */
 	if (mode == 1) {	/* lock */
-		sprintf(saved_path, "%s/LCK..%s", _PATH_LOCKD, path);
+		snprintf(saved_path, PATH_MAX, "%s/LCK..%s", _PATH_LOCKD, path);
+		for (p = saved_path + strlen(_PATH_LOCKD) + 1; *p; p++)
+			if (*p == '/')
+				*p = '_';
 		if (tty_already_locked(saved_path)) {
 			fprintf(stderr, "/dev/%s already locked\n", path);
 			return -1;
@@ -143,16 +231,16 @@ static int tty_lock(char *path, int mode)
 			return 0;
 		}
 		(void) chown(saved_path, pw->pw_uid, pw->pw_gid);
-		saved_lock = 1;
+		*saved_lock = 1;
 	} else {	/* unlock */
-		if (saved_lock != 1)
+		if (*saved_lock != 1)
 			return 0;
 		if (unlink(saved_path) < 0) {
 			fprintf(stderr, "tty_unlock: (%s): %s\n",
 				saved_path, strerror(errno));
 			return -1;
 		}
-		saved_lock = 0;
+		*saved_lock = 0;
 	}
 	
 	return 0;
@@ -258,6 +346,32 @@ static int tty_set_speed(struct termios *tty, const char *speed)
 }
 
 
+/*
+ * Ask the low-level driver to push received characters to the
+ * line discipline immediately instead of batching them, which
+ * costs milliseconds per burst. Not every driver supports this.
+ */
+static int tty_set_low_latency(struct tty_port *port)
+{
+	struct serial_struct ss;
+
+	if (ioctl(port->fd, TIOCGSERIAL, &port->serial_before) < 0) {
+		fprintf(stderr, "tty_open: TIOCGSERIAL: %s, low latency mode unavailable\n",
+			strerror(errno));
+		return -errno;
+	}
+	ss = port->serial_before;
+	ss.flags |= ASYNC_LOW_LATENCY;
+	if (ioctl(port->fd, TIOCSSERIAL, &ss) < 0) {
+		fprintf(stderr, "tty_open: TIOCSSERIAL: %s, low latency mode unavailable\n",
+			strerror(errno));
+		return -errno;
+	}
+	port->serial_saved = 1;
+
+	return 0;
+}
+
 /* Put a terminal line in a transparent state. */
 static int tty_set_raw(struct termios *tty)
 {
@@ -281,11 +395,11 @@ static int tty_set_raw(struct termios *tty)
 
 
 /* Fetch the state of a terminal. */
-static int tty_get_state(struct termios *tty)
+static int tty_get_state(struct tty_port *port, struct termios *tty)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TCGETS, tty) < 0) {
+	if (ioctl(port->fd, TCGETS, tty) < 0) {
 		saved_errno = errno;
 		perror("Get TTY State:");
 		return -saved_errno;
@@ -295,11 +409,11 @@ static int tty_get_state(struct termios *tty)
 }
 
 /* Set the state of a terminal. */
-static int tty_set_state(struct termios *tty)
+static int tty_set_state(struct tty_port *port, struct termios *tty)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TCSETS, tty) < 0) {
+	if (ioctl(port->fd, TCSETS, tty) < 0) {
 		saved_errno = errno;
 		perror("Set TTY State:");
 		return -saved_errno;
@@ -309,11 +423,11 @@ static int tty_set_state(struct termios *tty)
 }
 
 /* Get the TTY line discipline. */
-static int tty_get_ldisc(int *disc)
+static int tty_get_ldisc(struct tty_port *port, int *disc)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TIOCGETD, disc) < 0) {
+	if (ioctl(port->fd, TIOCGETD, disc) < 0) {
 		saved_errno = errno;
 		perror("get ldisc: failed to get line discipline");
 		fprintf(stderr, "Is the Lunix:TNG discipline actually loaded?!\n");
@@ -324,11 +438,11 @@ static int tty_get_ldisc(int *disc)
 }
 
 /* Set the TTY line discipline. */
-static int tty_set_ldisc(int disc)
+static int tty_set_ldisc(struct tty_port *port, int disc)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TIOCSETD, &disc) < 0) {
+	if (ioctl(port->fd, TIOCSETD, &disc) < 0) {
 		saved_errno = errno;
 		perror("set ldisc: failed to set line discipline");
 		return -saved_errno;
@@ -338,14 +452,14 @@ static int tty_set_ldisc(int disc)
 }
 
 /* Restore the TTY to its previous state. */
-static int tty_restore(void)
+static int tty_restore(struct tty_port *port)
 {
 	int ret;
 	struct termios tty;
 
-	tty = tty_before;
+	tty = port->before;
   	(void) tty_set_speed(&tty, "0");
-	if ((ret = tty_set_state(&tty)) < 0) {
+	if ((ret = tty_set_state(port, &tty)) < 0) {
 		fprintf(stderr, "slattach: tty_restore: %s\n",
 			strerror(-ret));
 		return ret;
@@ -355,25 +469,40 @@ static int tty_restore(void)
 }
 
 /* Close down a terminal line. */
-static int tty_close(void)
+static int tty_close(struct tty_port *port)
 {
 	/*
 	 * Set the old discipline and restore the
 	 * previous line mode.
 	 */
-	(void) tty_set_ldisc(ldisc_before);
-	(void) tty_restore();
-	(void) tty_lock(NULL, 0);
+	if (port->fd >= 0) {
+		(void) tty_set_ldisc(port, port->ldisc_before);
+		if (port->serial_saved)
+			(void) ioctl(port->fd, TIOCSSERIAL, &port->serial_before);
+		(void) tty_restore(port);
+		if (port->fd > 0)
+			(void) close(port->fd);
+		port->fd = -1;
+	}
+	port->state_saved = 0;
+	port->serial_saved = 0;
+	port->attached = 0;
+	(void) tty_lock(port, NULL, 0);
 
 	return 0;
 }
 
-/* Open and initialize a terminal line. */
-static int tty_open(char *name)
+/*
+ * Open and initialize a terminal line. Unless attach is set,
+ * the line is left in raw mode without the Lunix discipline.
+ */
+static int tty_open(struct tty_port *port, int attach)
 {
+	char *name = port->name;
 	int fd;
 	int ret;
 	int saved_errno;
+	char framing[4];
 	char pathbuf[PATH_MAX];
 	register char *path_open, *path_lock;
 
@@ -396,7 +525,7 @@ static int tty_open(char *name)
 		}
 	
 		fprintf(stderr, "tty_open: looking for lock\n");
-		if (tty_lock(path_lock, 1))
+		if (tty_lock(port, path_lock, 1))
 			return -1 ; /* can we lock the device? */
 		fprintf(stderr, "tty_open: trying to open %s\n",
 			path_open);
@@ -406,29 +535,30 @@ static int tty_open(char *name)
 				path_open, strerror(errno));
 			return -saved_errno;
 		}
-		tty_fd = fd;
+		port->fd = fd;
 		fprintf(stderr, "tty_open: %s (fd=%d) ", path_open, fd);
   	} else {
-		tty_fd = 0;
+		port->fd = 0;
 	}
 
 	/* Fetch the current state of the terminal. */
-	if (tty_get_state(&tty_before) < 0) {
+	if (tty_get_state(port, &port->before) < 0) {
 		saved_errno = errno;
 		fprintf(stderr, "tty_open: cannot get current state\n");
 		return -saved_errno;
 	}
-	tty_current = tty_before;
+	port->current = port->before;
 	
 	/* Fetch the current line discipline of this terminal. */
-	if (tty_get_ldisc(&ldisc_before) < 0) {
+	if (tty_get_ldisc(port, &port->ldisc_before) < 0) {
 		saved_errno = errno;
 		fprintf(stderr, "tty_open: cannot get current line disc\n");
 		return -saved_errno;
 	}
+	port->state_saved = 1;
 
 	/* Put this terminal line in a 8-bit transparent mode. */
-	if (tty_set_raw(&tty_current) < 0) {
+	if (tty_set_raw(&port->current) < 0) {
 		saved_errno = errno;
 		fprintf(stderr, "tty_open: cannot set RAW mode\n");
 		return -saved_errno;
@@ -436,64 +566,664 @@ static int tty_open(char *name)
 
 	/**************************************************
 	 * The sensor needs to be setup at
-	 * 57600bps, 8 data bits, No parity, 1 stop bit:
+	 * 57600bps, 8 data bits, No parity, 1 stop bit,
+	 * unless told otherwise on the command line:
 	 **************************************************
 	 */
-	if (tty_set_speed(&tty_current, "57600") != 0) {
-			saved_errno = errno;
-			fprintf(stderr, "tty_open: cannot set data rate to 57600bps\n");
-			return -saved_errno;
+	if (tty_set_speed(&port->current, tty_params.speed) != 0) {
+			fprintf(stderr, "tty_open: cannot set data rate to %sbps\n",
+				tty_params.speed);
+			return -EINVAL;
 	}
-	if (tty_set_databits(&tty_current, "8") ||
-	    tty_set_stopbits(&tty_current, "1") ||
-	    tty_set_parity(&tty_current, "N")) {
-	    	saved_errno = errno;
-		fprintf(stderr, "tty_open: cannot set 8N1 mode\n");
-		return -saved_errno;
+	strncpy(framing, tty_params.framing, sizeof(framing) - 1);
+	framing[sizeof(framing) - 1] = '\0';
+	if (strlen(framing) != 3 ||
+	    tty_set_databits(&port->current, &framing[0]) ||
+	    tty_set_parity(&port->current, &framing[1]) ||
+	    tty_set_stopbits(&port->current, &framing[2])) {
+		fprintf(stderr, "tty_open: cannot set %s mode\n", tty_params.framing);
+		return -EINVAL;
   	};
+	port->current.c_cc[VMIN] = tty_params.vmin;
+	port->current.c_cc[VTIME] = tty_params.vtime;
 
 	/* Set the new line mode. */
-	if ((ret = tty_set_state(&tty_current)) < 0)
+	if ((ret = tty_set_state(port, &port->current)) < 0)
 		return ret;
 
+	if (tty_params.low_latency)
+		(void) tty_set_low_latency(port);
+
 	/* And activate the new line discipline */
-	if ((ret = tty_set_ldisc(N_LUNIX_LDISC)) < 0)
+	if (attach && (ret = tty_set_ldisc(port, N_LUNIX_LDISC)) < 0)
 		return ret;
+	port->attached = attach;
 		
 	return 0;
 }
 
-/* Catch any signals. */
+/*
+ * Catch any signals. They only set a flag, the main loop of
+ * each mode notices it once the blocking call is interrupted.
+ */
+static volatile sig_atomic_t sig_stop;
+static volatile sig_atomic_t sig_report;
+
 static void sig_catch(int sig)
 {
-	tty_close();
-	exit(0);
+	if (sig == SIGUSR1)
+		sig_report = 1;
+	else
+		sig_stop = 1;
+}
+
+static void sig_setup(void)
+{
+	struct sigaction sa;
+
+	/* No SA_RESTART, a signal must interrupt a blocking call */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_catch;
+	sigemptyset(&sa.sa_mask);
+	(void) sigaction(SIGHUP, &sa, NULL);
+	(void) sigaction(SIGINT, &sa, NULL);
+	(void) sigaction(SIGQUIT, &sa, NULL);
+	(void) sigaction(SIGTERM, &sa, NULL);
+	(void) sigaction(SIGUSR1, &sa, NULL);
+}
+
+/*
+ * Undo what a failed tty_open() got done: it may return
+ * with the line open, the lock file taken, or both, and
+ * with the line settings already changed. Those go back
+ * to what they were through tty_close(), or every retry
+ * would take the changed ones for the original ones.
+ */
+static void tty_open_failed(struct tty_port *port)
+{
+	if (port->state_saved) {
+		(void) tty_close(port);
+		return;
+	}
+	if (port->fd > 0)
+		(void) close(port->fd);
+	port->fd = -1;
+	(void) tty_lock(port, NULL, 0);
+}
+
+/*
+ * Attach the discipline to a port, releasing
+ * the TTY again if anything goes wrong.
+ */
+static int port_attach(struct tty_port *port)
+{
+	if (tty_open(port, 1) < 0) {
+		tty_open_failed(port);
+		return -1;
+	}
+	port->backoff_ms = PORT_BACKOFF_MIN_MS;
+	memset(&port->last, 0, sizeof(port->last));
+	port->last_usec = lunix_capture_now();
+	fprintf(stderr, "\nLine discipline set on %s\n", port->name);
+
+	return 0;
+}
+
+/* Print per-port throughput since the previous report. */
+static void ports_print_stats(struct tty_port *ports, int nports)
+{
+	int i;
+	double secs;
+	uint64_t now;
+	struct lunix_ldisc_stats st;
+	struct tty_port *port;
+
+	now = lunix_capture_now();
+	for (i = 0; i < nports; i++) {
+		port = &ports[i];
+		if (!port->attached) {
+			fprintf(stderr, "%s: detached, %lu reopens\n", port->name, port->reopens);
+			continue;
+		}
+		if (ioctl(port->fd, LUNIX_LDISC_IOC_STATS, &st) < 0) {
+			fprintf(stderr, "%s: no statistics: %s\n", port->name, strerror(errno));
+			continue;
+		}
+		secs = (now - port->last_usec) / 1e6;
+		if (secs <= 0)
+			secs = 1e-6;
+		fprintf(stderr, "%s: %llu bytes, %llu packets, %llu dropped; "
+			"%.1f bytes/s, %.1f packets/s; %lu reopens\n", port->name,
+			(unsigned long long)st.bytes, (unsigned long long)st.packets,
+			(unsigned long long)st.dropped,
+			(st.bytes - port->last.bytes) / secs,
+			(st.packets - port->last.packets) / secs, port->reopens);
+		port->last = st;
+		port->last_usec = now;
+	}
+}
+
+/*
+ * Keep the discipline attached to all ports until told to stop.
+ * A port that hangs up is released and reopened with backoff.
+ */
+static int ports_supervise(struct tty_port *ports, int nports)
+{
+	int i, n, timeout;
+	uint64_t now;
+	struct pollfd *pfd;
+	struct tty_port **polled;
+
+	pfd = calloc(nports, sizeof(*pfd));
+	polled = calloc(nports, sizeof(*polled));
+	if (!pfd || !polled) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < nports; i++) {
+		if (port_attach(&ports[i]) < 0) {
+			while (--i >= 0)
+				tty_close(&ports[i]);
+			free(pfd);
+			free(polled);
+			return -1;
+		}
+	}
+	sig_setup();
+	fprintf(stderr, "Supervising %d port%s, send SIGUSR1 for statistics, "
+		"press ^C to release the TTYs...\n", nports, nports == 1 ? "" : "s");
+
+	while (!sig_stop) {
+		now = lunix_capture_now();
+		timeout = 1000;
+		for (i = n = 0; i < nports; i++) {
+			if (ports[i].attached) {
+				/* Nothing to read, only hangups are reported */
+				pfd[n].fd = ports[i].fd;
+				pfd[n].events = 0;
+				polled[n++] = &ports[i];
+			} else if (ports[i].retry_at > now &&
+			           (ports[i].retry_at - now) / 1000 < timeout) {
+				timeout = (ports[i].retry_at - now) / 1000;
+			}
+		}
+
+		if (poll(pfd, n, timeout) < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+
+		if (sig_report) {
+			sig_report = 0;
+			ports_print_stats(ports, nports);
+		}
+
+		now = lunix_capture_now();
+		for (i = 0; i < n; i++) {
+			if (!(pfd[i].revents & (POLLHUP | POLLERR | POLLNVAL)))
+				continue;
+			fprintf(stderr, "%s: hangup, releasing it\n", polled[i]->name);
+			tty_close(polled[i]);
+			polled[i]->retry_at = now + polled[i]->backoff_ms * 1000ULL;
+		}
+		for (i = 0; i < nports; i++) {
+			if (ports[i].attached || ports[i].retry_at > now)
+				continue;
+			if (port_attach(&ports[i]) == 0) {
+				ports[i].reopens++;
+				continue;
+			}
+			ports[i].backoff_ms = MIN(ports[i].backoff_ms * 2, PORT_BACKOFF_MAX_MS);
+			ports[i].retry_at = now + ports[i].backoff_ms * 1000ULL;
+			fprintf(stderr, "%s: reopen failed, retrying in %u ms\n",
+				ports[i].name, ports[i].backoff_ms);
+		}
+	}
+
+	ports_print_stats(ports, nports);
+	for (i = 0; i < nports; i++)
+		tty_close(&ports[i]);
+	free(pfd);
+	free(polled);
+
+	return 0;
+}
+
+/*
+ * TCP feeder mode
+ */
+static double timespec_elapsed(const struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) + (now.tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void tcp_print_stats(const struct tcp_stats *st)
+{
+	double secs = timespec_elapsed(&st->start);
+
+	fprintf(stderr, "tcp: %llu bytes in %.1f s (%.1f KiB/s), %llu reads "
+		"(%.0f bytes/read), %lu connects, %lu failed attempts, %lu disconnects\n",
+		st->bytes, secs, secs > 0 ? st->bytes / 1024.0 / secs : 0.0,
+		st->reads, st->reads ? (double)st->bytes / st->reads : 0.0,
+		st->connects, st->failures, st->disconnects);
+}
+
+/* Sleep for the given number of milliseconds, unless a signal arrives. */
+static void tcp_backoff(unsigned int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	(void) nanosleep(&ts, NULL);
+}
+
+/* Split "host:port" and connect to it, returning the socket. */
+static int tcp_connect(const char *endpoint)
+{
+	int fd, ret, one;
+	char host[256];
+	const char *colon;
+	struct addrinfo hints, *res, *ai;
+
+	if (!(colon = strrchr(endpoint, ':')) || colon == endpoint ||
+	    colon - endpoint >= sizeof(host)) {
+		fprintf(stderr, "tcp: endpoint must be of the form host:port\n");
+		return -EINVAL;
+	}
+	memcpy(host, endpoint, colon - endpoint);
+	host[colon - endpoint] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((ret = getaddrinfo(host, colon + 1, &hints, &res)) != 0) {
+		fprintf(stderr, "tcp: cannot resolve %s: %s\n", endpoint, gai_strerror(ret));
+		return -EAGAIN;
+	}
+
+	fd = -ECONNREFUSED;
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			fd = -errno;
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		ret = -errno;
+		close(fd);
+		fd = ret;
+	}
+	freeaddrinfo(res);
+
+	if (fd >= 0) {
+		/* We only receive, but keep the peer from batching tiny frames */
+		one = 1;
+		(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+/* Write all of buf, retrying on short writes. */
+static int insist_write(int fd, const unsigned char *buf, size_t cnt)
+{
+	ssize_t ret;
+
+	while (cnt > 0) {
+		ret = write(fd, buf, cnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		cnt -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Connect to endpoint and forward everything received to out_path,
+ * reconnecting with exponential backoff whenever the connection drops.
+ */
+static int tcp_feed(const char *endpoint, const char *out_path,
+	struct lunix_capture *cap)
+{
+	int out_fd, sock_fd, ret;
+	ssize_t cnt;
+	unsigned int backoff;
+	struct tcp_stats st;
+	static unsigned char buf[TCP_BUFSZ];
+
+	if ((out_fd = open(out_path, O_WRONLY)) < 0) {
+		fprintf(stderr, "tcp: cannot open %s: %s\n", out_path, strerror(errno));
+		if (errno == ENOENT)
+			fprintf(stderr, "Is the Lunix:TNG module actually loaded?!\n");
+		return -1;
+	}
+
+	sig_setup();
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	memset(&st, 0, sizeof(st));
+	clock_gettime(CLOCK_MONOTONIC, &st.start);
+	backoff = TCP_BACKOFF_MIN_MS;
+	ret = 0;
+
+	fprintf(stderr, "Forwarding %s to %s, send SIGUSR1 for statistics, "
+		"press ^C to stop...\n", endpoint, out_path);
+
+	while (!sig_stop) {
+		if ((sock_fd = tcp_connect(endpoint)) < 0) {
+			if (sock_fd == -EINVAL) {
+				ret = -1;
+				break;
+			}
+			st.failures++;
+			fprintf(stderr, "tcp: connect to %s failed (%s), retrying in %u ms\n",
+				endpoint, strerror(-sock_fd), backoff);
+			tcp_backoff(backoff);
+			backoff = MIN(backoff * 2, TCP_BACKOFF_MAX_MS);
+			if (sig_report) {
+				sig_report = 0;
+				tcp_print_stats(&st);
+			}
+			continue;
+		}
+		st.connects++;
+		backoff = TCP_BACKOFF_MIN_MS;
+		fprintf(stderr, "tcp: connected to %s\n", endpoint);
+
+		while (!sig_stop) {
+			cnt = read(sock_fd, buf, sizeof(buf));
+			if (sig_report) {
+				sig_report = 0;
+				tcp_print_stats(&st);
+			}
+			if (cnt < 0 && errno == EINTR)
+				continue;
+			if (cnt <= 0) {
+				fprintf(stderr, "tcp: connection to %s lost: %s\n", endpoint,
+					cnt < 0 ? strerror(errno) : "closed by peer");
+				st.disconnects++;
+				break;
+			}
+			if (insist_write(out_fd, buf, cnt) < 0) {
+				fprintf(stderr, "tcp: write to %s failed: %s\n",
+					out_path, strerror(errno));
+				sig_stop = 1;
+				ret = -1;
+				break;
+			}
+			if (cap && lunix_capture_write(cap, lunix_capture_now(), buf, cnt) < 0) {
+				fprintf(stderr, "tcp: write to capture file failed\n");
+				sig_stop = 1;
+				ret = -1;
+				break;
+			}
+			st.reads++;
+			st.bytes += cnt;
+		}
+		close(sock_fd);
+	}
+
+	tcp_print_stats(&st);
+	close(out_fd);
+	return ret;
+}
+
+/*
+ * Capture-only mode for a serial line: keep the TTY in raw mode
+ * and record whatever arrives, without attaching the discipline.
+ */
+static int tty_capture(char *name, struct lunix_capture *cap)
+{
+	ssize_t cnt;
+	struct tty_port port = { .name = name, .fd = -1 };
+	unsigned long long bytes = 0, reads = 0;
+	static unsigned char buf[TCP_BUFSZ];
+
+	if (tty_open(&port, 0) < 0) {
+		tty_open_failed(&port);
+		return -1;
+	}
+
+	/* tty_open() leaves the line non-blocking */
+	(void) fcntl(port.fd, F_SETFL, fcntl(port.fd, F_GETFL) & ~O_NONBLOCK);
+
+	sig_setup();
+
+	fprintf(stderr, "Capturing %s, press ^C to stop...\n", name);
+	while (!sig_stop) {
+		cnt = read(port.fd, buf, sizeof(buf));
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0) {
+			fprintf(stderr, "capture: read from %s: %s\n", name,
+				cnt < 0 ? strerror(errno) : "hangup");
+			break;
+		}
+		if (lunix_capture_write(cap, lunix_capture_now(), buf, cnt) < 0) {
+			fprintf(stderr, "capture: write to capture file failed\n");
+			break;
+		}
+		bytes += cnt;
+		reads++;
+	}
+	fprintf(stderr, "capture: %llu bytes in %llu reads\n", bytes, reads);
+
+	tty_close(&port);
+	return 0;
+}
+
+/*
+ * Measurement mode: with the current line settings, time the gaps
+ * between successive bursts [read() returns] on a raw line.
+ * Compare runs with and without -L, or with different VMIN/VTIME,
+ * to see what the settings buy.
+ */
+#define MEASURE_BUCKETS	24	/* log2(usec) buckets, up to ~8 s */
+
+static int tty_measure(char *name, unsigned long bursts)
+{
+	ssize_t cnt;
+	int b, bottom, top;
+	unsigned long n, hist[MEASURE_BUCKETS];
+	uint64_t now, prev, gap, gap_min, gap_max, gap_sum;
+	unsigned long long bytes;
+	struct tty_port port = { .name = name, .fd = -1 };
+	static unsigned char buf[TCP_BUFSZ];
+
+	if (tty_open(&port, 0) < 0) {
+		tty_open_failed(&port);
+		return -1;
+	}
+	(void) fcntl(port.fd, F_SETFL, fcntl(port.fd, F_GETFL) & ~O_NONBLOCK);
+
+	/* ^C stops early, with the line restored and the bursts so far printed */
+	sig_setup();
+
+	fprintf(stderr, "\nMeasuring %lu bursts on %s at %sbps %s, VMIN=%d VTIME=%d, "
+		"low latency %s...\n", bursts, name, tty_params.speed, tty_params.framing,
+		tty_params.vmin, tty_params.vtime, port.serial_saved ? "on" : "off");
+
+	memset(hist, 0, sizeof(hist));
+	gap_min = UINT64_MAX;
+	gap_max = gap_sum = 0;
+	bytes = 0;
+	prev = 0;
+	for (n = 0; n <= bursts && !sig_stop; ) {
+		cnt = read(port.fd, buf, sizeof(buf));
+		now = lunix_capture_now();
+		if (cnt < 0 && errno == EINTR)
+			continue;
+		if (cnt <= 0) {
+			fprintf(stderr, "measure: read from %s: %s\n", name,
+				cnt < 0 ? strerror(errno) : "hangup");
+			break;
+		}
+		/* The first burst only starts the clock */
+		if (n++ > 0) {
+			gap = now - prev;
+			gap_sum += gap;
+			if (gap < gap_min)
+				gap_min = gap;
+			if (gap > gap_max)
+				gap_max = gap;
+			for (b = 0; b < MEASURE_BUCKETS - 1 && (gap >> (b + 1)); b++)
+				;
+			hist[b]++;
+			bytes += cnt;
+		}
+		prev = now;
+	}
+	tty_close(&port);
+
+	if (n < 2) {
+		fprintf(stderr, "measure: not enough bursts\n");
+		return -1;
+	}
+	n--;
+	printf("%lu bursts, %.1f bytes/burst, inter-burst gap min %.3f ms, "
+		"avg %.3f ms, max %.3f ms\n", n, (double)bytes / n,
+		gap_min / 1e3, gap_sum / 1e3 / n, gap_max / 1e3);
+	for (top = MEASURE_BUCKETS - 1; top > 0 && !hist[top]; top--)
+		;
+	for (bottom = 0; bottom < top && !hist[bottom]; bottom++)
+		;
+	for (b = bottom; b <= top; b++)
+		printf("  %8llu - %8llu us: %lu\n", b ? 1ULL << b : 0ULL,
+			(2ULL << b) - 1, hist[b]);
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [line options] tty_line...\n"
+		"       %s [line options] -w capture | -M bursts tty_line\n"
+		"       %s -T host:port [-o output] [-w capture]\n\n"
+		"where tty_line is a TTY on which to set the Lunix line discipline.\n"
+		"Ports that hang up are reopened; SIGUSR1 prints per-port throughput.\n\n"
+		"Line options:\n"
+		"  -s speed      line speed in bps [default: %s]\n"
+		"  -F framing    data bits, parity, stop bits [default: %s]\n"
+		"  -L            low latency mode [ASYNC_LOW_LATENCY]\n"
+		"  -m vmin       VMIN for raw reads [default: %d]\n"
+		"  -t vtime      VTIME for raw reads, in 1/10 s [default: %d]\n"
+		"  -M bursts     do not attach; time the gaps between this many\n"
+		"                bursts received on tty_line and print a histogram\n\n"
+		"  -T host:port  connect to a TCP endpoint and forward its data straight\n"
+		"                into the driver, reconnecting whenever it drops\n"
+		"  -o output     where -T writes its data [default: %s]\n"
+		"  -w capture    record the raw stream with receive timestamps;\n"
+		"                a tty_line is then only captured, not attached\n\n",
+		argv0, argv0, argv0, tty_params.speed, tty_params.framing,
+		tty_params.vmin, tty_params.vtime, LUNIX_INJECT_PATH);
+	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) {
-		fprintf(stderr,
-			"Usage: %s tty_line\n"
-			"where tty_line is the TTY on which to set the Lunix line discipline.\n\n",
-			argv[0]);
-		exit(1);
+	int opt, ret, i, nports;
+	struct tty_port *ports;
+	const char *tcp_endpoint = NULL;
+	const char *tcp_output = LUNIX_INJECT_PATH;
+	const char *capture_path = NULL;
+	unsigned long measure_bursts = 0;
+	struct lunix_capture cap;
+
+	while ((opt = getopt(argc, argv, "T:o:w:s:F:Lm:t:M:")) != -1) {
+		switch (opt) {
+		case 'T':
+			tcp_endpoint = optarg;
+			break;
+		case 'o':
+			tcp_output = optarg;
+			break;
+		case 'w':
+			capture_path = optarg;
+			break;
+		case 's':
+			if (tty_find_speed(optarg) < 0) {
+				fprintf(stderr, "unsupported line speed %s\n", optarg);
+				exit(1);
+			}
+			tty_params.speed = optarg;
+			break;
+		case 'F':
+			tty_params.framing = optarg;
+			break;
+		case 'L':
+			tty_params.low_latency = 1;
+			break;
+		case 'm':
+			tty_params.vmin = atoi(optarg);
+			if (tty_params.vmin < 0 || tty_params.vmin > 255)
+				usage(argv[0]);
+			break;
+		case 't':
+			tty_params.vtime = atoi(optarg);
+			if (tty_params.vtime < 0 || tty_params.vtime > 255)
+				usage(argv[0]);
+			break;
+		case 'M':
+			measure_bursts = strtoul(optarg, NULL, 0);
+			if (!measure_bursts)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
 	}
-	
-	if (tty_open(argv[1]) < 0)
+
+	if (tcp_endpoint ? optind != argc : optind >= argc)
+		usage(argv[0]);
+	if ((measure_bursts || capture_path) && !tcp_endpoint && optind != argc - 1)
+		usage(argv[0]);
+
+	if (measure_bursts) {
+		if (tcp_endpoint || capture_path)
+			usage(argv[0]);
+		return tty_measure(argv[optind], measure_bursts) < 0;
+	}
+
+	if (capture_path && (ret = lunix_capture_create(&cap, capture_path)) < 0) {
+		fprintf(stderr, "cannot create capture file %s: %s\n",
+			capture_path, strerror(-ret));
 		return 1;
-	
-	fprintf(stderr, "Line discipline set on %s, press ^C to release the TTY...\n",
-		argv[1]);
-	
-  	(void) signal(SIGHUP, sig_catch);
-  	(void) signal(SIGINT, sig_catch);
-  	(void) signal(SIGQUIT, sig_catch);
-  	(void) signal(SIGTERM, sig_catch);
-	
-	while (pause())
-		;
+	}
+
+	if (tcp_endpoint || capture_path) {
+		if (tcp_endpoint)
+			ret = tcp_feed(tcp_endpoint, tcp_output, capture_path ? &cap : NULL);
+		else
+			ret = tty_capture(argv[optind], &cap);
+		if (capture_path && lunix_capture_close(&cap) < 0) {
+			fprintf(stderr, "error closing capture file %s\n", capture_path);
+			ret = -1;
+		}
+		return ret < 0;
+	}
+
+	/* One or more TTYs to attach to and supervise */
+	nports = argc - optind;
+	if (!(ports = calloc(nports, sizeof(*ports)))) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nports; i++) {
+		ports[i].name = argv[optind + i];
+		ports[i].fd = -1;
+	}
+	ret = ports_supervise(ports, nports);
+	free(ports);
 
-	/* Unreachable */
-	return 100;
+	return ret < 0;
 }
@@ -0,0 +1,147 @@
+/*
+ * lunix-capture.c
+ *
+ * Reading and writing of Lunix:TNG raw stream capture files.
+ * See lunix-capture.h for the file format.
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lunix-capture.h"
+
+uint64_t lunix_capture_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int put_le(FILE *fp, uint64_t v, int bytes)
+{
+	while (bytes--) {
+		if (fputc(v & 0xFF, fp) == EOF)
+			return -EIO;
+		v >>= 8;
+	}
+	return 0;
+}
+
+static int get_le(FILE *fp, uint64_t *v, int bytes)
+{
+	int c, shift;
+
+	*v = 0;
+	for (shift = 0; shift < bytes * 8; shift += 8) {
+		if ((c = fgetc(fp)) == EOF)
+			return -EIO;
+		*v |= (uint64_t)c << shift;
+	}
+	return 0;
+}
+
+static int put_varint(FILE *fp, uint64_t v)
+{
+	while (v >= 0x80) {
+		if (fputc((v & 0x7F) | 0x80, fp) == EOF)
+			return -EIO;
+		v >>= 7;
+	}
+	return fputc(v, fp) == EOF ? -EIO : 0;
+}
+
+/* Returns 1 on success, 0 on a clean end of file, < 0 on error */
+static int get_varint(FILE *fp, uint64_t *v)
+{
+	int c, shift;
+
+	*v = 0;
+	for (shift = 0; shift < 64; shift += 7) {
+		if ((c = fgetc(fp)) == EOF)
+			return shift ? -EIO : 0;
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return 1;
+	}
+	return -EINVAL;
+}
+
+int lunix_capture_create(struct lunix_capture *cap, const char *path)
+{
+	struct timespec ts;
+
+	if (!(cap->fp = fopen(path, "wb")))
+		return -errno;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	cap->start_usec = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	cap->last_usec = lunix_capture_now();
+
+	if (fwrite(LUNIX_CAPTURE_MAGIC, 8, 1, cap->fp) != 1 ||
+	    put_le(cap->fp, LUNIX_CAPTURE_VERSION, 4) ||
+	    put_le(cap->fp, cap->start_usec, 8)) {
+		fclose(cap->fp);
+		return -EIO;
+	}
+	return 0;
+}
+
+int lunix_capture_write(struct lunix_capture *cap, uint64_t usec,
+	const void *buf, size_t len)
+{
+	uint64_t delta;
+
+	delta = usec > cap->last_usec ? usec - cap->last_usec : 0;
+	cap->last_usec = usec;
+
+	if (put_varint(cap->fp, delta) || put_varint(cap->fp, len) ||
+	    fwrite(buf, 1, len, cap->fp) != len)
+		return -EIO;
+	return 0;
+}
+
+int lunix_capture_open(struct lunix_capture *cap, const char *path)
+{
+	char magic[8];
+	uint64_t version;
+
+	if (!(cap->fp = fopen(path, "rb")))
+		return -errno;
+
+	if (fread(magic, 8, 1, cap->fp) != 1 ||
+	    memcmp(magic, LUNIX_CAPTURE_MAGIC, 8) ||
+	    get_le(cap->fp, &version, 4) || version != LUNIX_CAPTURE_VERSION ||
+	    get_le(cap->fp, &cap->start_usec, 8)) {
+		fclose(cap->fp);
+		return -EINVAL;
+	}
+	cap->last_usec = 0;
+	return 0;
+}
+
+ssize_t lunix_capture_read(struct lunix_capture *cap, uint64_t *usec,
+	void *buf, size_t bufsz)
+{
+	int ret;
+	uint64_t delta, len;
+
+	if ((ret = get_varint(cap->fp, &delta)) <= 0)
+		return ret;
+	if (get_varint(cap->fp, &len) <= 0 || len > bufsz)
+		return -EINVAL;
+	if (fread(buf, 1, len, cap->fp) != len)
+		return -EIO;
+
+	cap->last_usec += delta;
+	*usec = cap->last_usec;
+	return len;
+}
+
+int lunix_capture_close(struct lunix_capture *cap)
+{
+	return fclose(cap->fp) ? -errno : 0;
+}
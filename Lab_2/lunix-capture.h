@@ -0,0 +1,50 @@
+/*
+ * lunix-capture.h
+ *
+ * Definition file for the Lunix:TNG raw stream capture format,
+ * shared by lunix-attach [recording] and lunix-replay [playback].
+ *
+ * A capture file is a fixed header followed by a sequence of records:
+ *
+ *   header:  "LUNIXCAP" | version (u32 LE) | start time, usec since Epoch (u64 LE)
+ *   record:  time since previous record, usec (varint)
+ *            | length (varint) | length raw bytes
+ *
+ * Varints are LEB128: 7 bits per byte, least significant group first.
+ * A busy stream costs 2-4 bytes of framing per receive.
+ *
+ */
+
+#ifndef _LUNIX_CAPTURE_H
+#define _LUNIX_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LUNIX_CAPTURE_MAGIC	"LUNIXCAP"
+#define LUNIX_CAPTURE_VERSION	1
+#define LUNIX_CAPTURE_MAXREC	(1 << 20)	/* largest record we accept */
+
+struct lunix_capture {
+	FILE *fp;
+	uint64_t start_usec;	/* wall clock time at capture start */
+	uint64_t last_usec;	/* timestamp of the previous record */
+};
+
+/* Current monotonic time in microseconds */
+uint64_t lunix_capture_now(void);
+
+/* Recording */
+int lunix_capture_create(struct lunix_capture *cap, const char *path);
+int lunix_capture_write(struct lunix_capture *cap, uint64_t usec,
+	const void *buf, size_t len);
+
+/* Playback: returns the record length, 0 at end of file, < 0 on error */
+int lunix_capture_open(struct lunix_capture *cap, const char *path);
+ssize_t lunix_capture_read(struct lunix_capture *cap, uint64_t *usec,
+	void *buf, size_t bufsz);
+
+int lunix_capture_close(struct lunix_capture *cap);
+
+#endif	/* _LUNIX_CAPTURE_H */
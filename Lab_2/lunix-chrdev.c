@@ -23,6 +23,13 @@
 #include <linux/mmzone.h>
 #include <linux/vmalloc.h>
 #include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/bitmap.h>
+#include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
 
 #include "lunix.h"
 #include "lunix-chrdev.h"
@@ -33,6 +40,66 @@
  */
 struct cdev lunix_chrdev_cdev;
 
+static dev_t lunix_chrdev_devt;
+static struct kmem_cache *lunix_chrdev_state_cache;
+static struct class *lunix_chrdev_class;
+
+/*
+ * Device nodes are created on demand, when a sensor first reports.
+ * Sensors report from atomic context, so they only mark themselves
+ * in lunix_chrdev_pending; a single work item then creates the nodes
+ * of every sensor marked so far, in one batch.
+ */
+static struct device **lunix_chrdev_devices;	/* [minor], NULL until created */
+static unsigned long *lunix_chrdev_pending;	/* bitmap of sensors */
+static bool lunix_chrdev_ready;
+
+/*
+ * Held from checking lunix_chrdev_ready to queueing the work, so that
+ * once lunix_chrdev_destroy() has cleared it under the lock no packet
+ * still arriving can queue the work again behind cancel_work_sync().
+ */
+static DEFINE_SPINLOCK(lunix_chrdev_ready_lock);
+static void lunix_chrdev_nodes_work(struct work_struct *work);
+static DECLARE_WORK(lunix_chrdev_work, lunix_chrdev_nodes_work);
+
+static const char *lunix_chrdev_msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+/*
+ * Convert a raw measurement to thousandths of the physical unit.
+ * The lookup tables live here, see mk_lookup_tables.c.
+ */
+long lunix_msr_convert(enum lunix_msr_enum type, uint16_t raw)
+{
+	switch (type) {
+	case BATT:
+		return lookup_voltage[raw];
+	case TEMP:
+		return lookup_temperature[raw];
+	case LIGHT:
+		return lookup_light[raw];
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Format a converted value, in thousandths, the way read() returns it
+ */
+static int lunix_chrdev_format(char *buf, size_t size, long tmp)
+{
+	// Updates the buffer and prints  from the data_buffer , maximum buffer size
+	// character decimal,decimal if tmp >= 0 print "empty" else print "-"
+	// print in |tmp|/1000 , |tmp|%1000 format  
+	unsigned long abs = tmp >= 0 ? tmp : -tmp;
+
+	return snprintf(buf, size, "%c%lu.%03lu\n", tmp >= 0 ? ' ' : '-', abs / 1000, abs % 1000);
+}
+
 /*
  * Just a quick [unlocked] check to see if the cached
  * chrdev state needs to be updated from sensor measurements.
@@ -44,11 +111,11 @@ static int lunix_chrdev_state_needs_refresh(struct lunix_chrdev_state_struct *st
 	// The following line is used in case of error to print the contents of the
 	// registers and the stack trace 
 	WARN_ON ( !(sensor = state->sensor));
-	/* Returns true  if  the last update value of the of the sensor last update time
-	   was larger than the last recorded timestamp of buffer update if true then 
-	   update sensor measurements
+	/* Returns true if the sensor has been updated since the measurement
+	   we cached. Compare sequence numbers rather than timestamps, which
+	   only have a resolution of one second.
 	 */
-    return sensor->msr_data[state->type]->last_update > state->buf_timestamp;
+    return READ_ONCE(sensor->msr_data[state->type]->values[LUNIX_MSR_SEQ]) != state->buf_seq;
 
 }
 
@@ -60,8 +127,8 @@ static int lunix_chrdev_state_needs_refresh(struct lunix_chrdev_state_struct *st
 static int lunix_chrdev_state_update(struct lunix_chrdev_state_struct *state)
 {
 	struct lunix_sensor_struct *sensor = state->sensor;
+	struct lunix_msr_data_struct *msr = sensor->msr_data[state->type];
 	unsigned long flags;
-    uint32_t value;
     long tmp;
 	
 	debug("leaving\n");
@@ -87,42 +154,49 @@ static int lunix_chrdev_state_update(struct lunix_chrdev_state_struct *state)
         spin_unlock_irqrestore(&sensor->lock, flags);
         return -EAGAIN;
     }
-	//Update timestamp of buffer
-	state->buf_timestamp = sensor->msr_data[state->type]->last_update;
-    // Gets the value of the sensor
-	value = sensor->msr_data[state->type]->values[0];
+	//Update timestamp and sequence number of buffer
+	state->buf_timestamp = msr->last_update;
+	state->buf_seq = msr->values[LUNIX_MSR_SEQ];
+    // Gets the value of the sensor, already converted by lunix_sensor_update()
+	state->buf_sample.seq = state->buf_seq / 2;
+	state->buf_sample.timestamp = state->buf_timestamp;
+	state->buf_sample.raw = msr->values[LUNIX_MSR_RAW];
+	state->buf_sample.value = (int32_t)msr->values[LUNIX_MSR_VALUE];
 	// Releases the lock and restores interupt state
 	// from flags 
     spin_unlock_irqrestore(&sensor->lock, flags);
 	/*
 	 * Now we can take our time to format them,
-	 * holding only the private state semaphore
+	 * holding only the private state mutex
 	 */
-	// Based on the  the type  of the sensor 
-	// we lookup the  conected recorded value 
-	// the reason we use lookups is because 
-	// we shouldnt do  floating point arithmetic
-	// in kernel_space 
-	    switch (state->type) {
-    case BATT:
-        tmp = lookup_voltage[value];
-        break;
-    case TEMP:
-        tmp = lookup_temperature[value];
-        break;
-    case LIGHT:
-        tmp = lookup_light[value];
-        break;
-    }
-	// Updates the buffer and prints  from the data_buffer , maximum buffer size
-	// character decimal,decimal if tmp >= 0 print "empty" else print "-"
-	// print in tmp/1000 ,  tmp%1000 format  
-	state->buf_lim = snprintf(state->buf_data, LUNIX_CHRDEV_BUFSZ, "%c%ld.%03ld\n", tmp >= 0 ? ' ' : '-', tmp / 1000, tmp % 1000);
+	// The value was converted through the lookup tables
+	// when it arrived, since we shouldnt do floating point
+	// arithmetic in kernel_space. Binary mode needs no text.
+	if (state->mode & LUNIX_MODE_BINARY)
+		return 0;
+	tmp = state->buf_sample.value;
+	state->buf_lim = lunix_chrdev_format(state->buf_data, LUNIX_CHRDEV_BUFSZ, tmp);
 
 	debug("leaving\n");
 	return 0;
 }
 
+/*
+ * Woken with the rest of the sensor's wait queue, on every update:
+ * pass it on to one exclusive waiter of this open file. Each open
+ * file in exclusive mode has its own entry, so one file's pool of
+ * readers can't use up the wakeup another one was waiting for.
+ */
+static int lunix_chrdev_excl_relay(wait_queue_entry_t *wait, unsigned int mode,
+	int sync, void *key)
+{
+	struct lunix_chrdev_state_struct *state =
+		container_of(wait, struct lunix_chrdev_state_struct, excl_relay);
+
+	__wake_up(&state->excl_wq, mode, 1, key);
+	return 0;
+}
+
 /*************************************
  * Implementation of file operations
  * for the Lunix character device
@@ -160,27 +234,39 @@ static int lunix_chrdev_open(struct inode *inode, struct file *filp)
 	// we take this from system and store it in
 	// a variable
 	minor_device_number = iminor(inode);
+	if (minor_device_number >= lunix_sensor_cnt * N_LUNIX_MSR) {
+		ret = -ENODEV;
+		goto out;
+	}
 	
 	/* Allocate a new Lunix character device private state structure */
-	// Standard method to allocate memory in kernel for a new  private state 
-	// structure GFP_Kernel underlines that memory is allocated on behalf of user
-	// and may sleep
-	state = kmalloc(sizeof(struct lunix_chrdev_state_struct), GFP_KERNEL);
+	// From a dedicated slab cache: clients opening and closing a node
+	// per sample get a recently freed, cache-hot object. GFP_Kernel
+	// underlines that memory is allocated on behalf of user and may sleep
+	state = kmem_cache_alloc(lunix_chrdev_state_cache, GFP_KERNEL);
 	// !of_pointer is equal to 0 which in c is considered as false
 	   if (!state) {
         ret = -ENOMEM;
         goto out;
     }	
-	//  From the 3 LSB  of the minor number of the inode we deduce the type of
-	//  the sensor 
-		state->type = minor_device_number & 7;
-	// The rest of the bits  indicate the number of the sensor 
-		state->sensor = &lunix_sensors[minor_device_number >> 3];
+	//  Minors are packed, sensor * N_LUNIX_MSR + type,
+	//  so we deduce the type and the number of the sensor
+		state->type = LUNIX_MINOR_TYPE(minor_device_number);
+		state->sensor = &lunix_sensors[LUNIX_MINOR_SENSOR(minor_device_number)];
 
 	// Set buf_timestap to 0 since this is the initialisation of the device
 	   	state->buf_timestamp = 0;
-	// Init semaphore to 1 in order for the first procces to grab it 
-		sema_init(&state->lock, 1);
+	// Sequence number 0: nothing has been received yet
+		state->buf_seq = 0;
+		state->buf_lim = 0;
+		state->mode = 0;
+		init_waitqueue_head(&state->excl_wq);
+		init_waitqueue_func_entry(&state->excl_relay, lunix_chrdev_excl_relay);
+		lunix_history_rewind(&state->hist_pos);
+	// Init mutex, unlocked, for the first procces to grab it 
+		mutex_init(&state->lock);
+	// Counted per measurement, for the statistics in debugfs
+		atomic_inc(&state->sensor->readers[state->type]);
 	// Private_data is set to null by open sys_call
 	// we use this to preserve data across sys_calls 
 		filp->private_data = state;
@@ -194,21 +280,165 @@ out:
 
 static int lunix_chrdev_release(struct inode *inode, struct file *filp)
 {
+	struct lunix_chrdev_state_struct *state = filp->private_data;
+
+	if (state->mode & LUNIX_MODE_EXCLUSIVE)
+		remove_wait_queue(&state->sensor->wq, &state->excl_relay);
+	atomic_dec(&state->sensor->readers[state->type]);
 	/* Free memory allocated for device */
-	kfree(filp->private_data);
+	kmem_cache_free(lunix_chrdev_state_cache, state);
+	return 0;
+}
+
+/*
+ * Copy the latest samples of a range of sensors to userspace,
+ * holding each sensor's spinlock just long enough to copy its pages.
+ */
+static long lunix_chrdev_snapshot(struct lunix_snapshot __user *usnap)
+{
+	int i, t;
+	unsigned long flags;
+	struct lunix_snapshot snap;
+	struct lunix_sample sample[N_LUNIX_MSR];
+	struct lunix_sensor_struct *sensor;
+	struct lunix_msr_data_struct *msr;
+	struct lunix_sample __user *out;
+
+	if (copy_from_user(&snap, usnap, sizeof(snap)))
+		return -EFAULT;
+	if (snap.first >= lunix_sensor_cnt)
+		return -EINVAL;
+	snap.count = min_t(uint32_t, snap.count, lunix_sensor_cnt - snap.first);
+	out = (struct lunix_sample __user *)(uintptr_t)snap.samples;
+
+	for (i = 0; i < snap.count; i++) {
+		sensor = &lunix_sensors[snap.first + i];
+		spin_lock_irqsave(&sensor->lock, flags);
+		for (t = 0; t < N_LUNIX_MSR; t++) {
+			msr = sensor->msr_data[t];
+			sample[t].seq = msr->values[LUNIX_MSR_SEQ] / 2;
+			sample[t].timestamp = msr->last_update;
+			sample[t].raw = msr->values[LUNIX_MSR_RAW];
+			sample[t].value = (int32_t)msr->values[LUNIX_MSR_VALUE];
+		}
+		spin_unlock_irqrestore(&sensor->lock, flags);
+		if (copy_to_user(out + i * N_LUNIX_MSR, sample, sizeof(sample)))
+			return -EFAULT;
+	}
+	return snap.count;
+}
+
+/*
+ * Summarize a time range of the history of the node's measurement,
+ * see lunix_history_query().
+ */
+static long lunix_chrdev_query(struct lunix_chrdev_state_struct *state,
+	struct lunix_query __user *uq)
+{
+	unsigned long flags;
+	struct lunix_query q;
+	struct lunix_history_summary res;
+	struct lunix_sensor_struct *sensor = state->sensor;
+
+	if (copy_from_user(&q, uq, sizeof(q)))
+		return -EFAULT;
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	lunix_history_query(&sensor->hist[state->type], state->type, q.from_ms, q.to_ms, &res);
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	q.count = res.count;
+	q.sum = res.sum;
+	q.min = res.count ? res.min : 0;
+	q.max = res.count ? res.max : 0;
+	q.avg = res.count ? (int32_t)div_s64(res.sum, res.count) : 0;
+	q.pad = 0;
+
+	if (copy_to_user(uq, &q, sizeof(q)))
+		return -EFAULT;
 	return 0;
 }
 
-// Returns invalid  argument passed 
 static long lunix_chrdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
-{   // if driver does not offer icotl
-	// return -EINVAL
-	return -EINVAL;
+{
+	int mode;
+	long ret;
+	struct lunix_chrdev_state_struct *state = filp->private_data;
+
+	if (_IOC_TYPE(cmd) != LUNIX_IOC_MAGIC || _IOC_NR(cmd) > LUNIX_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case LUNIX_IOC_GET_MODE:
+		return put_user(state->mode, (int __user *)arg);
+
+	case LUNIX_IOC_SET_MODE:
+		if (get_user(mode, (int __user *)arg))
+			return -EFAULT;
+		if (mode & ~LUNIX_MODE_MASK)
+			return -EINVAL;
+		if ((mode & (LUNIX_MODE_HISTORY | LUNIX_MODE_STREAM)) &&
+		    !state->sensor->hist[state->type].nr_chunks)
+			return -EOPNOTSUPP;
+		if (mutex_lock_interruptible(&state->lock))
+			return -ERESTARTSYS;
+		/* Exclusive waiters get wakeups through the relay, while in the mode */
+		if ((mode & LUNIX_MODE_EXCLUSIVE) && !(state->mode & LUNIX_MODE_EXCLUSIVE))
+			add_wait_queue(&state->sensor->wq, &state->excl_relay);
+		if (!(mode & LUNIX_MODE_EXCLUSIVE) && (state->mode & LUNIX_MODE_EXCLUSIVE))
+			remove_wait_queue(&state->sensor->wq, &state->excl_relay);
+		/* Changing the format invalidates the cached measurement */
+		state->mode = mode;
+		/* Readers still waiting exclusively go back to the sensor's queue */
+		if (!(mode & LUNIX_MODE_EXCLUSIVE))
+			wake_up_interruptible_all(&state->excl_wq);
+		state->buf_lim = 0;
+		state->buf_seq = 0;
+		if (mode & LUNIX_MODE_STREAM)
+			lunix_history_seek_end(state->sensor, state->type, &state->hist_pos);
+		else
+			lunix_history_rewind(&state->hist_pos);
+		filp->f_pos = 0;
+		mutex_unlock(&state->lock);
+		return 0;
+
+	case LUNIX_IOC_SNAPSHOT:
+		ret = lunix_chrdev_snapshot((struct lunix_snapshot __user *)arg);
+		return ret;
+
+	case LUNIX_IOC_QUERY:
+		return lunix_chrdev_query(state, (struct lunix_query __user *)arg);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
-static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t cnt, loff_t *f_pos)
+/*
+ * Sleep on the sensor's wait queue until cond holds. In exclusive mode
+ * the reader queues as an exclusive waiter on the open file's own
+ * queue instead, where every update wakes only one of them [see
+ * lunix_chrdev_excl_relay()], so a pool of threads sharing an open
+ * node gets one wakeup per sample, not a herd. Leaving the mode
+ * wakes them all, to wait on the sensor's queue again.
+ */
+#define lunix_chrdev_wait_event(state, wq, cond)				\
+	(((state)->mode & LUNIX_MODE_EXCLUSIVE) ?				\
+		wait_event_interruptible_exclusive((state)->excl_wq,		\
+			(cond) || !((state)->mode & LUNIX_MODE_EXCLUSIVE)) :	\
+		wait_event_interruptible(wq, cond))
+
+/*
+ * read() and splice() both end up here: copy_to_iter() writes to a
+ * user buffer, or straight into the pages of a pipe.
+ */
+static ssize_t lunix_chrdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     ssize_t ret;
+    size_t cnt = iov_iter_count(to);
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    int nonblock = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
 
     struct lunix_sensor_struct *sensor;
     struct lunix_chrdev_state_struct *state;
@@ -219,17 +449,46 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
     sensor = state->sensor;
     WARN_ON(!sensor);;
 
+	/*
+	 * Binary mode: a buffer too short for a whole sample is refused
+	 * up front, before a fresh measurement is waited for and consumed.
+	 */
+	if ((state->mode & (LUNIX_MODE_BINARY | LUNIX_MODE_HISTORY | LUNIX_MODE_STREAM)) ==
+	    LUNIX_MODE_BINARY && cnt < sizeof(struct lunix_sample))
+		return -EINVAL;
+
 	/* Lock? */
-	/* If lock(semaphore) is already acquired by someone else then
-	procces is put in the wait_queue. If semaphore acquired return 0
+	/* If lock(mutex) is already acquired by someone else then
+	procces is put to sleep. If mutex acquired return 0
 	and we dont get inside if  statement else enter if statement */
 
-	/*Attempts to acquire the semaphore.If no more tasks are allowed to acquire the semaphore
-	calling this function will put the task to sleep.If the sleep is interrupted by a signal, 
-	this function will return -EINTR. If the semaphore is successfully acquired, this function returns 0.*/
-    if (down_interruptible(&state->lock))
+	/*Attempts to acquire the mutex. For the common single reader it is free,
+	and taking it is a single atomic operation, without entering the scheduler.
+	If the sleep is interrupted by a signal, this function will return -EINTR.*/
+    if (mutex_lock_interruptible(&state->lock))
         return -ERESTARTSYS;
 		/*Restartable syscall */
+	/*
+	 * History mode: decode straight from the history store.
+	 * Streaming mode: the same, but wait instead of returning 0
+	 * once caught up. Either way, one call drains every sample
+	 * that fits, which is what makes splice() worthwhile.
+	 */
+	if (state->mode & (LUNIX_MODE_HISTORY | LUNIX_MODE_STREAM)) {
+		while ((ret = lunix_history_read(sensor, state->type, &state->hist_pos, to)) == 0 &&
+		       (state->mode & LUNIX_MODE_STREAM)) {
+			mutex_unlock(&state->lock);
+			if (nonblock)
+				return -EAGAIN;
+			if (lunix_chrdev_wait_event(state, sensor->wq,
+				!lunix_history_caught_up(sensor, state->type, &state->hist_pos)))
+				return -ERESTARTSYS;
+			if (mutex_lock_interruptible(&state->lock))
+				return -ERESTARTSYS;
+		}
+		goto out;
+	}
+
 	/*
 	 * If the cached character device state needs to be
 	 * updated by actual sensor data (i.e. we need to report
@@ -239,11 +498,11 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 	if value is 0 then this  is a new measurement */
 	    if (*f_pos == 0) {
         while (lunix_chrdev_state_update(state) == -EAGAIN) {
-			  /* Release the semaphore since the proccess will sleep
+			  /* Release the mutex since the proccess will sleep
 			   later on with wait_even			
 			*/
-            up(&state->lock);
-            if (filp->f_flags & O_NONBLOCK)
+            mutex_unlock(&state->lock);
+            if (nonblock)
                 return -EAGAIN;
             /* The process needs to sleep */
 			/* The process needs to sleep until condition is evaluated
@@ -251,16 +510,34 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 			the woken que is  woken up returns 0 if condition to refresh is evaluated
 			and erastsys interrupted wq is a quee waiting for procceses to be waken up
 			when sensor is ready to deliver new datum*/
-            if (wait_event_interruptible(sensor->wq, lunix_chrdev_state_needs_refresh(state)))
+            if (lunix_chrdev_wait_event(state, sensor->wq, lunix_chrdev_state_needs_refresh(state)))
                 return -ERESTARTSYS;
 			/*Start trying to acquire lock  */
-            if (down_interruptible(&state->lock))
+            if (mutex_lock_interruptible(&state->lock))
                 return -ERESTARTSYS;
         }
     }
 
+	/* Binary mode: one whole struct lunix_sample per read() */
+	if (state->mode & LUNIX_MODE_BINARY) {
+		/* Only if the mode changed since the check above */
+		if (cnt < sizeof(state->buf_sample)) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (copy_to_iter(&state->buf_sample, sizeof(state->buf_sample), to) !=
+		    sizeof(state->buf_sample)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		*f_pos = 0;
+		ret = sizeof(state->buf_sample);
+		goto out;
+	}
+
 	/* End of file */
 	if(*f_pos >= state->buf_lim){
+		mutex_unlock(&state->lock);
 		return 0;
 	}	
 	/* Determine the number of cached bytes to copy to userspace */
@@ -268,12 +545,12 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 	  then set the count of bytes to read to max */
 	if (cnt > state->buf_lim - *f_pos)
         cnt = state->buf_lim - *f_pos;
-	/* Copy to user returns  to user space cnt amount of bytes
-		usrbuf is the dst_addres in user space, second argument
-		is  kernel_space if everything was written succesfully then 
-		copy to user returs 0 and it does not enter the following if 
+	/* Copy to iter copies cnt bytes from kernel_space to the
+		destination of the iterator, user space or a pipe, and
+		returns how many it managed to copy; if everything was
+		written succesfully it does not enter the following if 
 		statement */
-    if (copy_to_user(usrbuf, state->buf_data + *f_pos, cnt)) {
+    if (copy_to_iter(state->buf_data + *f_pos, cnt, to) != cnt) {
         ret = -EFAULT;
         goto out;
     }
@@ -286,15 +563,47 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 	}
 out:
 	/*Unlock*/
-    up(&state->lock);
+    mutex_unlock(&state->lock);
 	
 	return ret;
 }
 
-// Optional support for memory mmaped I/O
+/*
+ * Map the measurement page read-only into userspace, for zero-copy access.
+ * Readers use the sequence number in the page to get consistent snapshots.
+ */
 static int lunix_chrdev_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	return -EINVAL;
+	struct lunix_chrdev_state_struct *state = filp->private_data;
+	struct lunix_msr_data_struct *msr = state->sensor->msr_data[state->type];
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(msr) >> PAGE_SHIFT,
+		PAGE_SIZE, vma->vm_page_prot);
+}
+
+/*
+ * Readable whenever a measurement newer than
+ * the one cached for this open file has arrived.
+ */
+static unsigned int lunix_chrdev_poll(struct file *filp, poll_table *wait)
+{
+	struct lunix_chrdev_state_struct *state = filp->private_data;
+
+	poll_wait(filp, &state->sensor->wq, wait);
+	if (state->mode & LUNIX_MODE_STREAM) {
+		if (!lunix_history_caught_up(state->sensor, state->type, &state->hist_pos))
+			return POLLIN | POLLRDNORM;
+		return 0;
+	}
+	if (lunix_chrdev_state_needs_refresh(state))
+		return POLLIN | POLLRDNORM;
+	return 0;
 }
 
 // Orizetai diasundesi twn syscall me ta antistoixa methods entos tou s
@@ -304,37 +613,207 @@ static struct file_operations lunix_chrdev_fops =
         .owner          = THIS_MODULE,
 	.open           = lunix_chrdev_open,
 	.release        = lunix_chrdev_release,
-	.read           = lunix_chrdev_read,
+	.read_iter      = lunix_chrdev_read_iter,
+	.splice_read    = generic_file_splice_read,
 	.unlocked_ioctl = lunix_chrdev_ioctl,
+	.poll           = lunix_chrdev_poll,
 	.mmap           = lunix_chrdev_mmap
 };
 
+/*
+ * Sysfs attributes of every node, under /sys/class/lunix/lunix<N>-<type>/:
+ * value [as read() would return it], raw, age_ms [since the last
+ * update], and the sensor's latest packet inter-arrival time and
+ * jitter, interval_us and jitter_us. One-shot probes read them
+ * without opening the node: no allocation, no mutex, no waiting
+ * for fresh data.
+ */
+static struct lunix_sensor_struct *lunix_chrdev_dev_sensor(struct device *dev,
+	enum lunix_msr_enum *type)
+{
+	*type = LUNIX_MINOR_TYPE(MINOR(dev->devt));
+	return &lunix_sensors[LUNIX_MINOR_SENSOR(MINOR(dev->devt))];
+}
+
+static ssize_t value_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	long value;
+	uint32_t seq;
+	unsigned long flags;
+	enum lunix_msr_enum type;
+	struct lunix_sensor_struct *sensor = lunix_chrdev_dev_sensor(dev, &type);
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	seq = sensor->msr_data[type]->values[LUNIX_MSR_SEQ];
+	value = (int32_t)sensor->msr_data[type]->values[LUNIX_MSR_VALUE];
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	if (!seq)
+		return -ENODATA;
+	return lunix_chrdev_format(buf, PAGE_SIZE, value);
+}
+
+static ssize_t raw_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	uint32_t seq, raw;
+	unsigned long flags;
+	enum lunix_msr_enum type;
+	struct lunix_sensor_struct *sensor = lunix_chrdev_dev_sensor(dev, &type);
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	seq = sensor->msr_data[type]->values[LUNIX_MSR_SEQ];
+	raw = sensor->msr_data[type]->values[LUNIX_MSR_RAW];
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	if (!seq)
+		return -ENODATA;
+	return sprintf(buf, "%u\n", raw);
+}
+
+static ssize_t age_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	uint64_t last_ms;
+	unsigned long flags;
+	enum lunix_msr_enum type;
+	struct lunix_sensor_struct *sensor = lunix_chrdev_dev_sensor(dev, &type);
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	last_ms = sensor->last_ms;
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	if (!last_ms)
+		return -ENODATA;
+	return sprintf(buf, "%lld\n", (long long)(ktime_to_ms(ktime_get_real()) - last_ms));
+}
+
+static ssize_t interval_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	uint32_t gap_us;
+	unsigned long gaps, flags;
+	enum lunix_msr_enum type;
+	struct lunix_sensor_struct *sensor = lunix_chrdev_dev_sensor(dev, &type);
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	gaps = sensor->iat.gaps;
+	gap_us = sensor->iat.gap_us;
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	if (!gaps)
+		return -ENODATA;
+	return sprintf(buf, "%u\n", gap_us);
+}
+
+static ssize_t jitter_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	uint64_t jitter16;
+	unsigned long gaps, flags;
+	enum lunix_msr_enum type;
+	struct lunix_sensor_struct *sensor = lunix_chrdev_dev_sensor(dev, &type);
+
+	spin_lock_irqsave(&sensor->lock, flags);
+	gaps = sensor->iat.gaps;
+	jitter16 = sensor->iat.jitter16;
+	spin_unlock_irqrestore(&sensor->lock, flags);
+
+	if (gaps < 2)
+		return -ENODATA;
+	return sprintf(buf, "%llu\n", (unsigned long long)(jitter16 >> 4));
+}
+
+static DEVICE_ATTR_RO(value);
+static DEVICE_ATTR_RO(raw);
+static DEVICE_ATTR_RO(age_ms);
+static DEVICE_ATTR_RO(interval_us);
+static DEVICE_ATTR_RO(jitter_us);
+
+static struct attribute *lunix_chrdev_attrs[] = {
+	&dev_attr_value.attr,
+	&dev_attr_raw.attr,
+	&dev_attr_age_ms.attr,
+	&dev_attr_interval_us.attr,
+	&dev_attr_jitter_us.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(lunix_chrdev);
+
+/*
+ * Create the nodes of every sensor that has appeared since the last run.
+ * udev names them lunix<sensor>-<measurement> under /dev.
+ */
+static void lunix_chrdev_nodes_work(struct work_struct *work)
+{
+	int sensor, type, created = 0;
+	unsigned int minor;
+	struct device *dev;
+
+	for_each_set_bit(sensor, lunix_chrdev_pending, lunix_sensor_cnt) {
+		clear_bit(sensor, lunix_chrdev_pending);
+		for (type = 0; type < N_LUNIX_MSR; type++) {
+			minor = LUNIX_MINOR(sensor, type);
+			if (lunix_chrdev_devices[minor])
+				continue;
+			dev = device_create_with_groups(lunix_chrdev_class, NULL,
+				MKDEV(MAJOR(lunix_chrdev_devt), minor), NULL, lunix_chrdev_groups,
+				"lunix%d-%s", sensor, lunix_chrdev_msr_names[type]);
+			if (IS_ERR(dev)) {
+				printk(KERN_WARNING "Lunix:TNG: cannot create node for sensor %d, ret = %ld\n",
+					sensor, PTR_ERR(dev));
+				continue;
+			}
+			lunix_chrdev_devices[minor] = dev;
+			created++;
+		}
+	}
+	debug("created %d device nodes\n", created);
+}
+
+/*
+ * Called by lunix_sensor_update() the first time a sensor reports,
+ * possibly in atomic context.
+ */
+void lunix_chrdev_sensor_appeared(int sensor)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lunix_chrdev_ready_lock, flags);
+	/* If not ready, lunix_chrdev_init() will pick it up */
+	if (lunix_chrdev_ready) {
+		set_bit(sensor, lunix_chrdev_pending);
+		schedule_work(&lunix_chrdev_work);
+	}
+	spin_unlock_irqrestore(&lunix_chrdev_ready_lock, flags);
+}
+
 // Method used to assign minor and major number to device 
 int lunix_chrdev_init(void)
 {
 	/*
 	 * Register the character device with the kernel, asking for
-	 * a range of minor numbers (number of sensors * 8 measurements / sensor)
-	 * beginning with LINUX_CHRDEV_MAJOR:0
+	 * a dynamically allocated major and a range of minor numbers
+	 * (number of sensors * N_LUNIX_MSR measurements / sensor)
 	 */
-	int ret;
-	dev_t dev_no;
-	unsigned int lunix_minor_cnt = lunix_sensor_cnt << 3;
+	int ret, i;
+	unsigned int lunix_minor_cnt = lunix_sensor_cnt * N_LUNIX_MSR;
 	
 	debug("initializing character device\n");
 	cdev_init(&lunix_chrdev_cdev, &lunix_chrdev_fops);
 	lunix_chrdev_cdev.owner = THIS_MODULE;
+
+	ret = -ENOMEM;
+	lunix_chrdev_state_cache = KMEM_CACHE(lunix_chrdev_state_struct, 0);
+	if (!lunix_chrdev_state_cache)
+		goto out;
+	lunix_chrdev_devices = kcalloc(lunix_minor_cnt, sizeof(*lunix_chrdev_devices), GFP_KERNEL);
+	lunix_chrdev_pending = kcalloc(BITS_TO_LONGS(lunix_sensor_cnt), sizeof(long), GFP_KERNEL);
+	if (!lunix_chrdev_devices || !lunix_chrdev_pending)
+		goto out_with_tables;
 	
-	dev_no = MKDEV(LUNIX_CHRDEV_MAJOR, 0);
-	// register_chrdev_region :registers a range of device numbers 
-	/* register_chrdev_region takes  3  attributes:
-	1) First in desired range of device numbers (Major number)
-	2) The total number of consecutive  numbers required
-	3) The name of the device driver  */
-	ret = register_chrdev_region(dev_no,lunix_minor_cnt,"lunix");
+	/* alloc_chrdev_region: registers a range of device numbers
+	   under a major number picked by the kernel */
+	ret = alloc_chrdev_region(&lunix_chrdev_devt, 0, lunix_minor_cnt, LUNIX_CHRDEV_NAME);
 	if (ret < 0) {
 		debug("failed to register region, ret = %d\n", ret);
-		goto out;
+		goto out_with_tables;
 	}	
 	/* ? */
 	/* cdev_add: Adds a character device in the system 
@@ -342,28 +821,63 @@ int lunix_chrdev_init(void)
 	1) First is the cdev structure for the device
 	2) The first device number for which the device is responisble
 	3) The number of consecutive minor numbers corresponding to this device */
-	ret = cdev_add(&lunix_chrdev_cdev,dev_no,lunix_minor_cnt);
+	ret = cdev_add(&lunix_chrdev_cdev, lunix_chrdev_devt, lunix_minor_cnt);
 	if (ret < 0) {
 		debug("failed to add character device\n");
 		goto out_with_chrdev_region;
 	}
-	debug("completed successfully\n");
+
+	/* Device class, for udev; no nodes until sensors report */
+	lunix_chrdev_class = class_create(THIS_MODULE, LUNIX_CHRDEV_NAME);
+	if (IS_ERR(lunix_chrdev_class)) {
+		ret = PTR_ERR(lunix_chrdev_class);
+		goto out_with_cdev;
+	}
+
+	/* Sensors that reported while we were getting here */
+	spin_lock_irq(&lunix_chrdev_ready_lock);
+	lunix_chrdev_ready = true;
+	spin_unlock_irq(&lunix_chrdev_ready_lock);
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		if (test_bit(LUNIX_SENSOR_SEEN, &lunix_sensors[i].flags))
+			lunix_chrdev_sensor_appeared(i);
+
+	debug("completed successfully, major %d\n", MAJOR(lunix_chrdev_devt));
 	return 0;
 
+out_with_cdev:
+	cdev_del(&lunix_chrdev_cdev);
 out_with_chrdev_region:
-	unregister_chrdev_region(dev_no, lunix_minor_cnt);
+	unregister_chrdev_region(lunix_chrdev_devt, lunix_minor_cnt);
+out_with_tables:
+	kfree(lunix_chrdev_devices);
+	kfree(lunix_chrdev_pending);
+	kmem_cache_destroy(lunix_chrdev_state_cache);
 out:
 	return ret;
 }
 
 void lunix_chrdev_destroy(void)
 {
-	dev_t dev_no;
-	unsigned int lunix_minor_cnt = lunix_sensor_cnt << 3;
+	unsigned int minor;
+	unsigned int lunix_minor_cnt = lunix_sensor_cnt * N_LUNIX_MSR;
 		
 	debug("entering\n");
-	dev_no = MKDEV(LUNIX_CHRDEV_MAJOR, 0);
+	/* The line discipline and injection device may still be feeding packets */
+	spin_lock_irq(&lunix_chrdev_ready_lock);
+	lunix_chrdev_ready = false;
+	spin_unlock_irq(&lunix_chrdev_ready_lock);
+	cancel_work_sync(&lunix_chrdev_work);
+
+	for (minor = 0; minor < lunix_minor_cnt; minor++)
+		if (lunix_chrdev_devices[minor])
+			device_destroy(lunix_chrdev_class, MKDEV(MAJOR(lunix_chrdev_devt), minor));
+	class_destroy(lunix_chrdev_class);
+
 	cdev_del(&lunix_chrdev_cdev);
-	unregister_chrdev_region(dev_no, lunix_minor_cnt);
+	unregister_chrdev_region(lunix_chrdev_devt, lunix_minor_cnt);
+	kfree(lunix_chrdev_devices);
+	kfree(lunix_chrdev_pending);
+	kmem_cache_destroy(lunix_chrdev_state_cache);
 	debug("leaving\n");
 }
@@ -10,17 +10,79 @@
 #ifndef _LUNIX_CHRDEV_H
 #define _LUNIX_CHRDEV_H
 
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
 /*
- * Lunix:TNG character device
+ * Lunix:TNG character device. The major number is allocated
+ * dynamically [see /proc/devices], minors are packed: one per
+ * sensor and measurement, sensor * N_LUNIX_MSR + type.
  */
-#define LUNIX_CHRDEV_MAJOR	60	/* Reserved for local / experimental use */
+#define LUNIX_CHRDEV_NAME	"lunix"
+#define LUNIX_CHRDEV_MAJOR	60	/* Historical fixed major, still the ioctl magic */
 #define LUNIX_CHRDEV_BUFSZ      20      /* Buffer size used to hold textual info */
 
+#define LUNIX_MINOR(sensor, type)	((sensor) * N_LUNIX_MSR + (type))
+#define LUNIX_MINOR_SENSOR(minor)	((minor) / N_LUNIX_MSR)
+#define LUNIX_MINOR_TYPE(minor)		((minor) % N_LUNIX_MSR)
+
+/*
+ * A single measurement, as returned by read() in binary mode
+ * and by LUNIX_IOC_SNAPSHOT.
+ */
+struct lunix_sample {
+	uint32_t seq;		/* update sequence number, 0: no data yet */
+	uint32_t timestamp;	/* seconds since the Epoch */
+	uint32_t raw;		/* raw 16-bit measurement */
+	int32_t value;		/* converted value, in thousandths */
+};
+
+/*
+ * A sample of the long-term history, as returned
+ * by read() in history mode [LUNIX_MODE_HISTORY].
+ */
+struct lunix_history_sample {
+	uint64_t timestamp_ms;	/* msec since the Epoch */
+	uint32_t raw;
+	int32_t value;		/* converted value, in thousandths */
+};
+
+/*
+ * LUNIX_IOC_SNAPSHOT: the latest samples of count sensors starting
+ * at first, N_LUNIX_MSR per sensor, stored in samples[] in
+ * sensor-major order. Returns the number of sensors copied.
+ */
+struct lunix_snapshot {
+	uint32_t first;
+	uint32_t count;
+	uint64_t samples;	/* struct lunix_sample *, in userspace */
+};
+
+/*
+ * LUNIX_IOC_QUERY: summary of the converted values of the history
+ * samples with from_ms <= timestamp < to_ms, for the measurement of
+ * the node. min, max and avg are meaningless if count is 0.
+ */
+struct lunix_query {
+	uint64_t from_ms;	/* in: msec since the Epoch */
+	uint64_t to_ms;		/* in */
+	uint64_t count;		/* out */
+	int64_t sum;		/* out, in thousandths */
+	int32_t min;		/* out */
+	int32_t max;		/* out */
+	int32_t avg;		/* out */
+	uint32_t pad;
+};
+
 /* Compile-time parameters */
 
 #ifdef __KERNEL__ 
 
 #include <linux/fs.h>
+#include <linux/mutex.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 
@@ -37,12 +99,27 @@ struct lunix_chrdev_state_struct {
 	int buf_lim;
 	unsigned char buf_data[LUNIX_CHRDEV_BUFSZ];
 	uint32_t buf_timestamp;
+	uint32_t buf_seq;		/* sequence number of the cached measurement */
+	struct lunix_sample buf_sample;	/* the same measurement, for binary mode */
 
-	struct semaphore lock;
+	struct mutex lock;
 
 	/*
-	 * Fixme: Any mode settings? e.g. blocking vs. non-blocking
+	 * Mode settings, LUNIX_MODE_* flags, see LUNIX_IOC_SET_MODE.
+	 * Blocking vs. non-blocking comes from O_NONBLOCK.
 	 */
+	int mode;
+
+	/*
+	 * Exclusive mode: blocked readers of this open file wait on
+	 * excl_wq, one of them woken per update of the sensor, by
+	 * excl_relay, on the sensor's wait queue while in the mode.
+	 */
+	wait_queue_head_t excl_wq;
+	wait_queue_entry_t excl_relay;
+
+	/* Read position in history mode */
+	struct lunix_history_cursor hist_pos;
 };
 
 /*
@@ -50,6 +127,7 @@ struct lunix_chrdev_state_struct {
  */
 int lunix_chrdev_init(void);
 void lunix_chrdev_destroy(void);
+void lunix_chrdev_sensor_appeared(int sensor);
 
 #endif	/* __KERNEL__ */
 
@@ -60,8 +138,26 @@ void lunix_chrdev_destroy(void);
  */
 #define LUNIX_IOC_MAGIC			LUNIX_CHRDEV_MAJOR
 //#define LUNIX_IOC_EXAMPLE		_IOR(LUNIX_IOC_MAGIC, 0, void *)
+#define LUNIX_IOC_GET_MODE		_IOR(LUNIX_IOC_MAGIC, 1, int)
+#define LUNIX_IOC_SET_MODE		_IOW(LUNIX_IOC_MAGIC, 2, int)
+#define LUNIX_IOC_SNAPSHOT		_IOWR(LUNIX_IOC_MAGIC, 3, struct lunix_snapshot)
+#define LUNIX_IOC_QUERY			_IOWR(LUNIX_IOC_MAGIC, 4, struct lunix_query)
 
-#define LUNIX_IOC_MAXNR			0	
+#define LUNIX_IOC_MAXNR			4
+
+/*
+ * Mode flags of an open node
+ */
+#define LUNIX_MODE_BINARY		0x01	/* read() returns struct lunix_sample */
+#define LUNIX_MODE_HISTORY		0x02	/* read() streams struct lunix_history_sample,
+						   oldest first, until caught up */
+#define LUNIX_MODE_STREAM		0x04	/* read() and splice() return every new
+						   struct lunix_history_sample, waiting for more
+						   once caught up; starts at the newest sample */
+#define LUNIX_MODE_EXCLUSIVE		0x08	/* blocked readers wait exclusively: an update
+						   wakes one of them. For pools of threads
+						   sharing the open node */
+#define LUNIX_MODE_MASK			0x0f
 
 #endif	/* _LUNIX_H */
 
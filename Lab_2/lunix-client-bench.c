@@ -0,0 +1,118 @@
+/*
+ * lunix-client-bench.c
+ *
+ * Compare the cost of fetching the latest Lunix:TNG measurement
+ * through every access method liblunix supports, and of fetching
+ * many sensors at once through lunix_snapshot().
+ *
+ * Needs at least one sample to have arrived for the chosen sensor;
+ * methods that are not available on this host are skipped.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lunix.h"
+#include "lunix-client.h"
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s sensor] [-t batt|temp|light] [-n calls] [-b sensors]\n\n"
+		"Calls lunix_latest() n times through each access method, then\n"
+		"lunix_snapshot() of b sensors [default 16] n / b times.\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, ret;
+	long i, calls = 1000000;
+	unsigned int sensor = 0, batch = 16;
+	enum lunix_msr_enum type = TEMP;
+	enum lunix_access how;
+	struct lunix_client *c;
+	struct lunix_sample s, *snap;
+	double t0, dt;
+
+	while ((opt = getopt(argc, argv, "s:t:n:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			sensor = atoi(optarg);
+			break;
+		case 't':
+			if (!strcmp(optarg, "batt"))
+				type = BATT;
+			else if (!strcmp(optarg, "temp"))
+				type = TEMP;
+			else if (!strcmp(optarg, "light"))
+				type = LIGHT;
+			else
+				usage(argv[0]);
+			break;
+		case 'n':
+			calls = atol(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (calls <= 0 || batch == 0)
+		usage(argv[0]);
+
+	snap = calloc(batch * N_LUNIX_MSR, sizeof(*snap));
+	if (!snap) {
+		perror("calloc");
+		exit(1);
+	}
+
+	printf("%-8s %14s %14s %16s\n", "method", "latest/s", "ns/call", "snapshot sens/s");
+	for (how = LUNIX_ACCESS_SHM; how <= LUNIX_ACCESS_TEXT; how++) {
+		c = lunix_open(sensor, type, how);
+		if (!c) {
+			printf("%-8s unavailable: %s\n", lunix_access_name(how), strerror(errno));
+			continue;
+		}
+		ret = lunix_latest(c, &s);
+		if (ret < 0) {
+			printf("%-8s no data: %s\n", lunix_access_name(how), strerror(-ret));
+			lunix_close(c);
+			continue;
+		}
+
+		t0 = now_sec();
+		for (i = 0; i < calls; i++)
+			lunix_latest(c, &s);
+		dt = now_sec() - t0;
+		printf("%-8s %14.0f %14.1f", lunix_access_name(how), calls / dt, dt * 1e9 / calls);
+
+		t0 = now_sec();
+		for (i = 0, ret = 0; i < calls / batch && ret >= 0; i++)
+			ret = lunix_snapshot(c, 0, batch, snap);
+		dt = now_sec() - t0;
+		if (ret < 0)
+			printf(" %16s\n", "-");
+		else
+			printf(" %16.0f\n", i * ret / dt);
+
+		lunix_close(c);
+	}
+
+	free(snap);
+	return 0;
+}
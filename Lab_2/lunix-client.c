@@ -0,0 +1,410 @@
+/*
+ * lunix-client.c
+ *
+ * liblunix: userspace client library for Lunix:TNG,
+ * see lunix-client.h for the interface.
+ *
+ * SHM and MMAP clients read a struct lunix_msr_data_struct page
+ * directly, retrying while its sequence number is odd or changes
+ * under them [lunix_shm_read()]; a sample costs a few loads. To wait
+ * for new data, SHM clients sleep on the futex lunixd wakes, MMAP
+ * clients poll() their node. BINARY and TEXT clients read() the node,
+ * which is kept non-blocking so that lunix_latest() never sleeps.
+ *
+ */
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "lunix.h"
+#include "lunix-shm.h"
+#include "lunix-chrdev.h"
+#include "lunix-client.h"
+
+struct lunix_client {
+	enum lunix_access how;
+	unsigned int sensor;
+	enum lunix_msr_enum type;
+
+	int fd;				/* device node, -1 for SHM */
+	void *map;			/* SHM segment or measurement page */
+	size_t map_len;
+	unsigned int sensor_cnt;	/* SHM: sensors in the segment */
+	struct lunix_msr_data_struct *msr;
+
+	struct lunix_sample last;	/* last sample returned by lunix_next() */
+	struct lunix_sample cache;	/* last sample read() from the node */
+	uint32_t text_seq;		/* TEXT: samples parsed so far */
+};
+
+static const char *msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+const char *lunix_access_name(enum lunix_access how)
+{
+	switch (how) {
+	case LUNIX_ACCESS_AUTO:		return "auto";
+	case LUNIX_ACCESS_SHM:		return "shm";
+	case LUNIX_ACCESS_MMAP:		return "mmap";
+	case LUNIX_ACCESS_BINARY:	return "binary";
+	case LUNIX_ACCESS_TEXT:		return "text";
+	}
+	return "unknown";
+}
+
+enum lunix_access lunix_access_method(const struct lunix_client *c)
+{
+	return c->how;
+}
+
+/*
+ * Map the segment published by lunixd. Refuse it if it looks
+ * foreign, or if the daemon that created it is gone.
+ */
+static int open_shm(struct lunix_client *c)
+{
+	int fd, ret;
+	struct stat st;
+	struct lunix_shm_header *hdr;
+
+	fd = shm_open(LUNIX_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	if (st.st_size < LUNIX_SHM_PAGE) {
+		ret = -EINVAL;
+		goto out;
+	}
+	c->map_len = st.st_size;
+	c->map = mmap(NULL, c->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	if (c->map == MAP_FAILED) {
+		c->map = NULL;
+		ret = -errno;
+		goto out;
+	}
+
+	hdr = c->map;
+	ret = -EINVAL;
+	if (hdr->magic != LUNIX_SHM_MAGIC || hdr->version != LUNIX_SHM_VERSION ||
+	    lunix_shm_size(hdr->sensor_cnt) > c->map_len)
+		goto out_unmap;
+	ret = -ENODEV;
+	if (c->sensor >= hdr->sensor_cnt)
+		goto out_unmap;
+	ret = -ESRCH;
+	if (kill(hdr->pid, 0) < 0 && errno == ESRCH)
+		goto out_unmap;
+
+	c->sensor_cnt = hdr->sensor_cnt;
+	c->msr = lunix_shm_msr(c->map, c->sensor, c->type);
+	ret = 0;
+	goto out;
+
+out_unmap:
+	munmap(c->map, c->map_len);
+	c->map = NULL;
+out:
+	close(fd);
+	return ret;
+}
+
+/*
+ * Open the device node, and set it up for the requested method.
+ */
+static int open_node(struct lunix_client *c, enum lunix_access how)
+{
+	int ret, mode;
+	char path[64];
+
+	snprintf(path, sizeof(path), LUNIX_CLIENT_DEV_FMT, c->sensor, msr_names[c->type]);
+	c->fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (c->fd < 0)
+		return -errno;
+
+	if (how == LUNIX_ACCESS_MMAP) {
+		c->map_len = LUNIX_SHM_PAGE;
+		c->map = mmap(NULL, c->map_len, PROT_READ, MAP_SHARED, c->fd, 0);
+		if (c->map == MAP_FAILED) {
+			c->map = NULL;
+			ret = -errno;
+			goto out_close;
+		}
+		c->msr = c->map;
+	}
+
+	/* MMAP clients block in binary read()s */
+	if (how != LUNIX_ACCESS_TEXT) {
+		mode = LUNIX_MODE_BINARY;
+		if (ioctl(c->fd, LUNIX_IOC_SET_MODE, &mode) < 0) {
+			ret = -errno;
+			goto out_unmap;
+		}
+	}
+	return 0;
+
+out_unmap:
+	if (c->map)
+		munmap(c->map, c->map_len);
+	c->map = NULL;
+	c->msr = NULL;
+out_close:
+	close(c->fd);
+	c->fd = -1;
+	return ret;
+}
+
+struct lunix_client *lunix_open(unsigned int sensor, enum lunix_msr_enum type,
+	enum lunix_access how)
+{
+	int ret;
+	enum lunix_access try;
+	struct lunix_client *c;
+
+	if (type >= N_LUNIX_MSR) {
+		errno = EINVAL;
+		return NULL;
+	}
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->sensor = sensor;
+	c->type = type;
+	c->fd = -1;
+
+	/* AUTO tries every method, cheapest first */
+	ret = -EINVAL;
+	for (try = LUNIX_ACCESS_SHM; try <= LUNIX_ACCESS_TEXT; try++) {
+		if (how != LUNIX_ACCESS_AUTO && how != try)
+			continue;
+		if (try == LUNIX_ACCESS_SHM)
+			ret = open_shm(c);
+		else
+			ret = open_node(c, try);
+		if (ret == 0) {
+			c->how = try;
+			return c;
+		}
+	}
+
+	free(c);
+	errno = -ret;
+	return NULL;
+}
+
+void lunix_close(struct lunix_client *c)
+{
+	if (!c)
+		return;
+	if (c->map)
+		munmap(c->map, c->map_len);
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c);
+}
+
+static int page_sample(const struct lunix_msr_data_struct *msr, struct lunix_sample *s)
+{
+	int32_t value;
+	uint32_t raw, last_update;
+
+	s->seq = lunix_shm_read(msr, &raw, &value, &last_update);
+	s->timestamp = last_update;
+	s->raw = raw;
+	s->value = value;
+	return s->seq ? 0 : -EAGAIN;
+}
+
+/*
+ * Parse the textual format of the driver, e.g. " 23.456\n" or "-0.250\n".
+ * TEXT samples carry no raw value; sequence numbers are our own.
+ */
+static int parse_text(const char *buf, struct lunix_sample *s)
+{
+	char sign;
+	unsigned long whole, frac;
+
+	if (sscanf(buf, "%c%lu.%3lu", &sign, &whole, &frac) != 3 ||
+	    (sign != ' ' && sign != '-'))
+		return -EPROTO;
+	s->raw = 0;
+	s->value = whole * 1000 + frac;
+	if (sign == '-')
+		s->value = -s->value;
+	s->timestamp = time(NULL);
+	return 0;
+}
+
+/*
+ * One non-blocking read() of the node. -EAGAIN if
+ * nothing arrived since the last one.
+ */
+static int node_read(struct lunix_client *c, struct lunix_sample *s)
+{
+	ssize_t n;
+	char buf[LUNIX_CHRDEV_BUFSZ + 1];
+
+	if (c->how != LUNIX_ACCESS_TEXT) {
+		n = read(c->fd, s, sizeof(*s));
+		if (n < 0)
+			return -errno;
+		if (n != sizeof(*s))
+			return -EIO;
+	} else {
+		n = read(c->fd, buf, sizeof(buf) - 1);
+		if (n < 0)
+			return -errno;
+		buf[n] = '\0';
+		if (parse_text(buf, s) < 0)
+			return -EPROTO;
+		s->seq = ++c->text_seq;
+	}
+	c->cache = *s;
+	return 0;
+}
+
+static int node_wait(struct lunix_client *c)
+{
+	struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+
+	if (poll(&pfd, 1, -1) < 0)
+		return -errno;
+	if (pfd.revents & (POLLERR | POLLNVAL))
+		return -EIO;
+	return 0;
+}
+
+int lunix_latest(struct lunix_client *c, struct lunix_sample *s)
+{
+	int ret;
+
+	if (c->msr)
+		return page_sample(c->msr, s);
+
+	ret = node_read(c, s);
+	if (ret == -EAGAIN && c->cache.seq) {
+		*s = c->cache;
+		return 0;
+	}
+	return ret;
+}
+
+int lunix_next(struct lunix_client *c, struct lunix_sample *s, int nonblock)
+{
+	int ret;
+	uint32_t seen;
+
+	for (;;) {
+		if (c->how == LUNIX_ACCESS_SHM) {
+			seen = __atomic_load_n(&c->msr->values[LUNIX_SHM_SEQ], __ATOMIC_ACQUIRE);
+			if (seen && !(seen & 1) && page_sample(c->msr, s) == 0 &&
+			    s->seq != c->last.seq)
+				break;
+			if (nonblock)
+				return -EAGAIN;
+			ret = lunix_shm_wait(&c->msr->values[LUNIX_SHM_SEQ], seen, NULL);
+			if (ret < 0 && ret != -EINTR)
+				return ret;
+			continue;
+		}
+
+		if (c->msr && page_sample(c->msr, s) == 0 && s->seq != c->last.seq)
+			break;
+		ret = node_read(c, s);
+		if (ret == 0 && s->seq != c->last.seq)
+			break;
+		if (ret < 0 && ret != -EAGAIN)
+			return ret;
+		if (ret == -EAGAIN) {
+			if (nonblock)
+				return -EAGAIN;
+			ret = node_wait(c);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	c->last = *s;
+	return 0;
+}
+
+int lunix_foreach(struct lunix_client *c,
+	int (*fn)(const struct lunix_sample *s, void *arg), void *arg)
+{
+	int ret;
+	struct lunix_sample s;
+
+	for (;;) {
+		ret = lunix_next(c, &s, 0);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			return ret;
+		ret = fn(&s, arg);
+		if (ret)
+			return ret;
+	}
+}
+
+int lunix_snapshot(struct lunix_client *c, unsigned int first,
+	unsigned int count, struct lunix_sample *out)
+{
+	int ret;
+	unsigned int i, t;
+	struct lunix_snapshot snap;
+
+	switch (c->how) {
+	case LUNIX_ACCESS_SHM:
+		if (first >= c->sensor_cnt)
+			return -EINVAL;
+		if (count > c->sensor_cnt - first)
+			count = c->sensor_cnt - first;
+		for (i = 0; i < count; i++)
+			for (t = 0; t < N_LUNIX_MSR; t++)
+				page_sample(lunix_shm_msr(c->map, first + i, t),
+				            &out[i * N_LUNIX_MSR + t]);
+		return count;
+
+	case LUNIX_ACCESS_MMAP:
+	case LUNIX_ACCESS_BINARY:
+		snap.first = first;
+		snap.count = count;
+		snap.samples = (uintptr_t)out;
+		ret = ioctl(c->fd, LUNIX_IOC_SNAPSHOT, &snap);
+		return ret < 0 ? -errno : ret;
+
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+int lunix_query(struct lunix_client *c, uint64_t from_ms, uint64_t to_ms,
+	struct lunix_query *q)
+{
+	if (c->how != LUNIX_ACCESS_MMAP && c->how != LUNIX_ACCESS_BINARY)
+		return -EOPNOTSUPP;
+
+	memset(q, 0, sizeof(*q));
+	q->from_ms = from_ms;
+	q->to_ms = to_ms;
+	if (ioctl(c->fd, LUNIX_IOC_QUERY, q) < 0)
+		return -errno;
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * lunix-client.h
+ *
+ * Definition file for liblunix, a small client library for
+ * reading Lunix:TNG measurements from userspace.
+ *
+ * A client is bound to one measurement of one sensor and fetches it
+ * through the cheapest access method available, in order:
+ *
+ *   LUNIX_ACCESS_SHM     the segment published by lunixd, no syscalls
+ *   LUNIX_ACCESS_MMAP    the driver's measurement page, mapped read-only
+ *   LUNIX_ACCESS_BINARY  read() of struct lunix_sample, LUNIX_MODE_BINARY
+ *   LUNIX_ACCESS_TEXT    read() and parse of the classic " 23.456\n" format
+ *
+ * All functions returning int return 0 [or a count] on success,
+ * a negative errno value on failure.
+ *
+ */
+
+#ifndef _LUNIX_CLIENT_H
+#define _LUNIX_CLIENT_H
+
+#include <stdint.h>
+
+#include "lunix.h"
+#include "lunix-chrdev.h"
+
+#define LUNIX_CLIENT_DEV_FMT	"/dev/lunix%u-%s"
+
+enum lunix_access {
+	LUNIX_ACCESS_AUTO = 0,
+	LUNIX_ACCESS_SHM,
+	LUNIX_ACCESS_MMAP,
+	LUNIX_ACCESS_BINARY,
+	LUNIX_ACCESS_TEXT
+};
+
+struct lunix_client;
+
+/* Returns NULL and sets errno on failure */
+struct lunix_client *lunix_open(unsigned int sensor, enum lunix_msr_enum type,
+	enum lunix_access how);
+void lunix_close(struct lunix_client *c);
+
+enum lunix_access lunix_access_method(const struct lunix_client *c);
+const char *lunix_access_name(enum lunix_access how);
+
+/*
+ * The latest sample, without waiting. -EAGAIN if
+ * the sensor has not reported anything yet.
+ */
+int lunix_latest(struct lunix_client *c, struct lunix_sample *s);
+
+/*
+ * The first sample newer than the last one returned by this client.
+ * Sleeps until it arrives, unless nonblock is set [-EAGAIN].
+ */
+int lunix_next(struct lunix_client *c, struct lunix_sample *s, int nonblock);
+
+/*
+ * Call fn for every new sample, until it returns non-zero.
+ * Returns the value fn returned, or a negative errno value.
+ */
+int lunix_foreach(struct lunix_client *c,
+	int (*fn)(const struct lunix_sample *s, void *arg), void *arg);
+
+/*
+ * Batch access: the latest samples of all measurements of sensors
+ * [first, first + count), N_LUNIX_MSR per sensor, sensor-major, in a
+ * single call. Returns the number of sensors copied. Not available
+ * through LUNIX_ACCESS_TEXT [-EOPNOTSUPP].
+ */
+int lunix_snapshot(struct lunix_client *c, unsigned int first,
+	unsigned int count, struct lunix_sample *out);
+
+/*
+ * Summary [count, min, max, avg, sum] of the measurement over the
+ * time range [from_ms, to_ms) of the driver's history, msec since the
+ * Epoch. Not available through LUNIX_ACCESS_SHM or _TEXT [-EOPNOTSUPP].
+ */
+int lunix_query(struct lunix_client *c, uint64_t from_ms, uint64_t to_ms,
+	struct lunix_query *q);
+
+#endif	/* _LUNIX_CLIENT_H */
@@ -0,0 +1,166 @@
+/*
+ * lunix-convert-bench.c
+ *
+ * Check and measure the bulk conversion of liblunix [lunix-convert.h].
+ *
+ * Every implementation is first run on all 65536 raw values of every
+ * measurement, and its results compared with the driver's lookup
+ * tables [lunix-lookup.h]; then it converts an array of random raw
+ * samples over and over, and its throughput is reported in samples
+ * per nanosecond, next to that of a per-sample lookup in the driver's
+ * tables.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "lunix.h"
+#include "lunix-convert.h"
+#include "lunix-lookup.h"
+
+static const char *msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+static long *lookup_tables[N_LUNIX_MSR] = {
+	[BATT]	= lookup_voltage,
+	[TEMP]	= lookup_temperature,
+	[LIGHT]	= lookup_light
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The way it is done today: one sample at a time, through the long tables */
+static __attribute__((noinline)) void convert_lookup(enum lunix_msr_enum type,
+	const uint16_t *raw, int32_t *out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = (int32_t)lookup_tables[type][raw[i]];
+}
+
+/* Compare the selected implementation with the driver's tables */
+static int verify(void)
+{
+	static uint16_t raw[65536 + 7];
+	static int32_t out[65536 + 7];
+	unsigned int t, i, off, bad = 0;
+
+	/* Odd offsets and lengths exercise the unaligned head and the tail */
+	for (off = 0; off < 8; off += 7)
+		for (t = 0; t < N_LUNIX_MSR; t++) {
+			for (i = 0; i < 65536; i++)
+				raw[off + i] = i;
+			memset(out, 0, sizeof(out));
+			lunix_convert(t, raw + off, out + off, 65536 - off);
+			for (i = 0; i < 65536 - off; i++)
+				if (out[off + i] != lookup_tables[t][i] ||
+				    out[off + i] != lunix_convert_one(t, i)) {
+					if (bad++ < 5)
+						fprintf(stderr, "%s: %s[%u] = %d, table has %ld\n",
+							lunix_convert_name(lunix_convert_selected()),
+							msr_names[t], i, out[off + i], lookup_tables[t][i]);
+				}
+		}
+
+	return bad;
+}
+
+static double bench(void (*fn)(enum lunix_msr_enum, const uint16_t *, int32_t *, size_t),
+	enum lunix_msr_enum type, const uint16_t *raw, int32_t *out, size_t n, int reps)
+{
+	int r;
+	double t0 = now_sec();
+
+	for (r = 0; r < reps; r++)
+		fn(type, raw, out, n);
+	return n * (double)reps / ((now_sec() - t0) * 1e9);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n samples] [-r repetitions] [-m max_raw]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, reps = 200, failed = 0;
+	unsigned long max_raw = 65535;
+	size_t i, n = 1 << 16;
+	uint16_t *raw;
+	int32_t *out;
+	enum lunix_msr_enum t;
+	enum lunix_convert_impl impl;
+	static const enum lunix_convert_impl impls[] = { LUNIX_CONVERT_SCALAR, LUNIX_CONVERT_AVX2 };
+
+	while ((opt = getopt(argc, argv, "n:r:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'm':
+			max_raw = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n == 0 || reps <= 0 || max_raw > 65535)
+		usage(argv[0]);
+
+	raw = malloc(n * sizeof(*raw));
+	out = malloc(n * sizeof(*out));
+	if (!raw || !out) {
+		perror("malloc");
+		exit(1);
+	}
+	srandom(1);
+	for (i = 0; i < n; i++)
+		raw[i] = random() % (max_raw + 1);
+
+	printf("%zu random samples in [0, %lu], %d repetitions\n\n", n, max_raw, reps);
+	printf("%-16s %-9s %12s %12s %12s\n", "", "identical", "batt", "temp", "light");
+	printf("%-16s %-9s", "lookup, 1 by 1", "-");
+	for (t = 0; t < N_LUNIX_MSR; t++)
+		printf(" %6.2f /ns  ", bench(convert_lookup, t, raw, out, n, reps));
+	printf("\n");
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		impl = impls[i];
+		if (lunix_convert_select(impl) < 0) {
+			printf("%-16s not supported on this CPU\n", lunix_convert_name(impl));
+			continue;
+		}
+		if (verify()) {
+			failed = 1;
+			printf("%-16s %-9s\n", lunix_convert_name(impl), "NO");
+			continue;
+		}
+		printf("%-16s %-9s", lunix_convert_name(impl), "yes");
+		for (t = 0; t < N_LUNIX_MSR; t++)
+			printf(" %6.2f /ns  ", bench(lunix_convert, t, raw, out, n, reps));
+		printf("\n");
+	}
+
+	free(raw);
+	free(out);
+	return failed;
+}
@@ -0,0 +1,125 @@
+/*
+ * lunix-convert.c
+ *
+ * Bulk conversion of raw measurements, see lunix-convert.h.
+ *
+ * Only the temperature conversion is costly [a log() and a pow() per
+ * sample], and evaluating a polynomial instead would not round the
+ * way the tables do; so all implementations are table lookups. The
+ * AVX2 one widens eight raw samples to 32-bit indices and fetches
+ * their values with a single gather. It is compiled with a target
+ * attribute and chosen at run time, so the library still runs on
+ * CPUs without AVX2 and needs no special compiler flags.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LUNIX_CONVERT_HAVE_AVX2	1
+#endif
+
+#include "lunix.h"
+#include "lunix-convert.h"
+#include "lunix-convert-tables.h"
+
+static const int32_t *const lunix_convert_tables[N_LUNIX_MSR] = {
+	[BATT]	= lunix_convert_batt,
+	[TEMP]	= lunix_convert_temp,
+	[LIGHT]	= lunix_convert_light
+};
+
+typedef void lunix_convert_fn(const int32_t *tab, const uint16_t *raw, int32_t *out, size_t n);
+
+static void lunix_convert_scalar(const int32_t *tab, const uint16_t *raw, int32_t *out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = tab[raw[i]];
+}
+
+#ifdef LUNIX_CONVERT_HAVE_AVX2
+__attribute__((target("avx2")))
+static void lunix_convert_avx2(const int32_t *tab, const uint16_t *raw, int32_t *out, size_t n)
+{
+	size_t i;
+	__m256i a, b;
+
+	/* Two gathers in flight per iteration, to hide their latency */
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(raw + i)));
+		b = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(raw + i + 8)));
+		a = _mm256_i32gather_epi32((const int *)tab, a, 4);
+		b = _mm256_i32gather_epi32((const int *)tab, b, 4);
+		_mm256_storeu_si256((__m256i *)(out + i), a);
+		_mm256_storeu_si256((__m256i *)(out + i + 8), b);
+	}
+	for (; i < n; i++)
+		out[i] = tab[raw[i]];
+}
+#endif
+
+static enum lunix_convert_impl lunix_convert_impl;
+static lunix_convert_fn *lunix_convert_impl_fn;
+
+const char *lunix_convert_name(enum lunix_convert_impl impl)
+{
+	switch (impl) {
+	case LUNIX_CONVERT_AUTO:	return "auto";
+	case LUNIX_CONVERT_SCALAR:	return "scalar";
+	case LUNIX_CONVERT_AVX2:	return "avx2";
+	}
+	return "unknown";
+}
+
+int lunix_convert_select(enum lunix_convert_impl impl)
+{
+#ifdef LUNIX_CONVERT_HAVE_AVX2
+	int avx2 = __builtin_cpu_supports("avx2");
+#else
+	int avx2 = 0;
+#endif
+
+	if (impl == LUNIX_CONVERT_AUTO)
+		impl = avx2 ? LUNIX_CONVERT_AVX2 : LUNIX_CONVERT_SCALAR;
+
+	switch (impl) {
+	case LUNIX_CONVERT_SCALAR:
+		lunix_convert_impl_fn = lunix_convert_scalar;
+		break;
+#ifdef LUNIX_CONVERT_HAVE_AVX2
+	case LUNIX_CONVERT_AVX2:
+		if (!avx2)
+			return -EOPNOTSUPP;
+		lunix_convert_impl_fn = lunix_convert_avx2;
+		break;
+#endif
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	lunix_convert_impl = impl;
+	return 0;
+}
+
+enum lunix_convert_impl lunix_convert_selected(void)
+{
+	if (!lunix_convert_impl_fn)
+		lunix_convert_select(LUNIX_CONVERT_AUTO);
+	return lunix_convert_impl;
+}
+
+int32_t lunix_convert_one(enum lunix_msr_enum type, uint16_t raw)
+{
+	return lunix_convert_tables[type][raw];
+}
+
+void lunix_convert(enum lunix_msr_enum type, const uint16_t *raw, int32_t *out, size_t n)
+{
+	if (!lunix_convert_impl_fn)
+		lunix_convert_select(LUNIX_CONVERT_AUTO);
+	lunix_convert_impl_fn(lunix_convert_tables[type], raw, out, n);
+}
@@ -0,0 +1,42 @@
+/*
+ * lunix-convert.h
+ *
+ * Bulk conversion of raw Lunix:TNG measurements to physical
+ * units, in thousandths, for userspace: part of liblunix.
+ *
+ * The results are bit-identical to the driver's lookup tables
+ * [lunix-lookup.h]: every implementation looks values up in the
+ * same generated tables [lunix-convert-tables.h], the AVX2 one
+ * eight samples at a time with a gather.
+ *
+ */
+
+#ifndef _LUNIX_CONVERT_H
+#define _LUNIX_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lunix.h"
+
+enum lunix_convert_impl {
+	LUNIX_CONVERT_AUTO = 0,		/* the fastest one this CPU supports */
+	LUNIX_CONVERT_SCALAR,
+	LUNIX_CONVERT_AVX2
+};
+
+/*
+ * Pick the implementation used by lunix_convert() from now on.
+ * Returns 0, or -EOPNOTSUPP if this CPU or build lacks it.
+ */
+int lunix_convert_select(enum lunix_convert_impl impl);
+enum lunix_convert_impl lunix_convert_selected(void);
+const char *lunix_convert_name(enum lunix_convert_impl impl);
+
+/* A single sample, as the driver converts it */
+int32_t lunix_convert_one(enum lunix_msr_enum type, uint16_t raw);
+
+/* out[i] = value of raw[i], for n samples of the measurement type */
+void lunix_convert(enum lunix_msr_enum type, const uint16_t *raw, int32_t *out, size_t n);
+
+#endif	/* _LUNIX_CONVERT_H */
@@ -0,0 +1,210 @@
+/*
+ * lunix-debugfs.c
+ *
+ * Statistics for Lunix:TNG, exported through debugfs
+ *
+ * <debugfs>/lunix/sensors has a header line, then a line per sensor:
+ *
+ *   sensor updates wakeups saved last_update readers_batt readers_temp readers_light
+ *
+ * where saved counts the updates that did not cost a wakeup of their
+ * own, because of wakeup coalescing [lunix_coalesce_us], and readers_*
+ * the files open on each of the sensor's nodes.
+ *
+ * <debugfs>/lunix/history has a line per sensor and measurement:
+ *
+ *   sensor type samples dropped bytes
+ *
+ * with bytes the memory the compressed history holds.
+ *
+ * <debugfs>/lunix/protocol has a header line, then the counters of
+ * the protocol state machines, summed over all TTYs and injection files:
+ *
+ *   bytes packets dropped
+ *
+ * <debugfs>/lunix/arrivals has a line per sensor, on the timing of
+ * its packets:
+ *
+ *   sensor gaps gap_us jitter_us b0 b1 ... b31
+ *
+ * gap_us is the latest inter-arrival time, jitter_us the smoothed
+ * deviation between consecutive ones, and bk the histogram of all
+ * inter-arrival times: bucket k counts gaps of [2^(k-1), 2^k) usec.
+ *
+ * All counters only ever grow; rates are left to the reader [lunix-top].
+ *
+ */
+
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+
+#include "lunix.h"
+#include "lunix-debugfs.h"
+#include "lunix-protocol.h"
+
+static struct dentry *lunix_debugfs_dir;
+
+static int lunix_debugfs_sensors_show(struct seq_file *m, void *v)
+{
+	int i;
+	struct lunix_sensor_struct *s;
+
+	seq_puts(m, "sensor updates wakeups saved last_update "
+		"readers_batt readers_temp readers_light\n");
+	for (i = 0; i < lunix_sensor_cnt; i++) {
+		s = &lunix_sensors[i];
+		seq_printf(m, "%d %ld %ld %ld %u %d %d %d\n", i,
+			atomic_long_read(&s->updates),
+			atomic_long_read(&s->wakeups),
+			atomic_long_read(&s->wakeups_saved),
+			READ_ONCE(s->msr_data[BATT]->last_update),
+			atomic_read(&s->readers[BATT]),
+			atomic_read(&s->readers[TEMP]),
+			atomic_read(&s->readers[LIGHT]));
+	}
+
+	return 0;
+}
+
+static int lunix_debugfs_sensors_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lunix_debugfs_sensors_show, NULL);
+}
+
+static const struct file_operations lunix_debugfs_sensors_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_debugfs_sensors_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+static int lunix_debugfs_history_show(struct seq_file *m, void *v)
+{
+	int i, t;
+	unsigned long flags, samples, dropped;
+	size_t bytes;
+	struct lunix_sensor_struct *s;
+
+	seq_puts(m, "sensor type samples dropped bytes\n");
+	for (i = 0; i < lunix_sensor_cnt; i++) {
+		s = &lunix_sensors[i];
+		for (t = 0; t < N_LUNIX_MSR; t++) {
+			spin_lock_irqsave(&s->lock, flags);
+			samples = s->hist[t].samples;
+			dropped = s->hist[t].dropped;
+			bytes = lunix_history_bytes(&s->hist[t]);
+			spin_unlock_irqrestore(&s->lock, flags);
+			seq_printf(m, "%d %d %lu %lu %zu\n", i, t, samples, dropped, bytes);
+		}
+	}
+
+	return 0;
+}
+
+static int lunix_debugfs_history_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lunix_debugfs_history_show, NULL);
+}
+
+static const struct file_operations lunix_debugfs_history_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_debugfs_history_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+static int lunix_debugfs_protocol_show(struct seq_file *m, void *v)
+{
+	seq_puts(m, "bytes packets dropped\n");
+	seq_printf(m, "%ld %ld %ld\n",
+		atomic_long_read(&lunix_protocol_totals.bytes),
+		atomic_long_read(&lunix_protocol_totals.packets),
+		atomic_long_read(&lunix_protocol_totals.dropped));
+
+	return 0;
+}
+
+static int lunix_debugfs_protocol_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lunix_debugfs_protocol_show, NULL);
+}
+
+static const struct file_operations lunix_debugfs_protocol_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_debugfs_protocol_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+static int lunix_debugfs_arrivals_show(struct seq_file *m, void *v)
+{
+	int i, k;
+	unsigned long flags;
+	struct lunix_iat_struct iat;
+	struct lunix_sensor_struct *s;
+
+	seq_puts(m, "sensor gaps gap_us jitter_us");
+	for (k = 0; k < LUNIX_IAT_BUCKETS; k++)
+		seq_printf(m, " b%d", k);
+	seq_putc(m, '\n');
+
+	for (i = 0; i < lunix_sensor_cnt; i++) {
+		s = &lunix_sensors[i];
+		spin_lock_irqsave(&s->lock, flags);
+		iat = s->iat;
+		spin_unlock_irqrestore(&s->lock, flags);
+
+		seq_printf(m, "%d %lu %u %llu", i, iat.gaps, iat.gap_us,
+			(unsigned long long)(iat.jitter16 >> 4));
+		for (k = 0; k < LUNIX_IAT_BUCKETS; k++)
+			seq_printf(m, " %u", iat.hist[k]);
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+static int lunix_debugfs_arrivals_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lunix_debugfs_arrivals_show, NULL);
+}
+
+static const struct file_operations lunix_debugfs_arrivals_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_debugfs_arrivals_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+void lunix_debugfs_init(void)
+{
+	lunix_debugfs_dir = debugfs_create_dir(LUNIX_DEBUGFS_DIR, NULL);
+	if (IS_ERR_OR_NULL(lunix_debugfs_dir)) {
+		printk(KERN_WARNING "Lunix:TNG: debugfs unavailable, no statistics\n");
+		lunix_debugfs_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("sensors", 0444, lunix_debugfs_dir, NULL,
+		&lunix_debugfs_sensors_fops);
+	debugfs_create_file("history", 0444, lunix_debugfs_dir, NULL,
+		&lunix_debugfs_history_fops);
+	debugfs_create_file("protocol", 0444, lunix_debugfs_dir, NULL,
+		&lunix_debugfs_protocol_fops);
+	debugfs_create_file("arrivals", 0444, lunix_debugfs_dir, NULL,
+		&lunix_debugfs_arrivals_fops);
+}
+
+void lunix_debugfs_destroy(void)
+{
+	debugfs_remove_recursive(lunix_debugfs_dir);
+	lunix_debugfs_dir = NULL;
+}
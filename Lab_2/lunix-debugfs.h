@@ -0,0 +1,32 @@
+/*
+ * lunix-debugfs.h
+ *
+ * Definition file for the
+ * Lunix:TNG debugfs statistics
+ *
+ */
+
+#ifndef _LUNIX_DEBUGFS_H
+#define _LUNIX_DEBUGFS_H
+
+/*
+ * Lunix:TNG statistics live in <debugfs>/lunix/, one file per topic.
+ */
+#define LUNIX_DEBUGFS_DIR	"lunix"
+#define LUNIX_DEBUGFS_SENSORS	"/sys/kernel/debug/" LUNIX_DEBUGFS_DIR "/sensors"
+#define LUNIX_DEBUGFS_HISTORY	"/sys/kernel/debug/" LUNIX_DEBUGFS_DIR "/history"
+#define LUNIX_DEBUGFS_PROTOCOL	"/sys/kernel/debug/" LUNIX_DEBUGFS_DIR "/protocol"
+#define LUNIX_DEBUGFS_ARRIVALS	"/sys/kernel/debug/" LUNIX_DEBUGFS_DIR "/arrivals"
+
+#ifdef __KERNEL__
+
+/*
+ * Function prototypes. Statistics are optional: failing to create
+ * them, e.g. without CONFIG_DEBUG_FS, does not fail the module.
+ */
+void lunix_debugfs_init(void);
+void lunix_debugfs_destroy(void);
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LUNIX_DEBUGFS_H */
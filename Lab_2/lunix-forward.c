@@ -0,0 +1,159 @@
+/*
+ * lunix-forward.c
+ *
+ * Forward every sample of a Lunix:TNG node to a TCP endpoint,
+ * without copying it through userspace: the node is put in
+ * streaming mode, and its output is spliced into a pipe and from
+ * there into the socket.
+ *
+ * The stream is a sequence of struct lunix_history_sample records,
+ * in host byte order.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "lunix.h"
+#include "lunix-chrdev.h"
+
+#define FORWARD_CHUNK	(64 * 1024)	/* bytes moved per splice() */
+
+static volatile sig_atomic_t stop;
+
+static void sig_catch(int sig)
+{
+	stop = 1;
+}
+
+static int tcp_connect(const char *endpoint)
+{
+	int fd, ret;
+	char host[256];
+	const char *colon;
+	struct addrinfo hints, *res, *ai;
+
+	if (!(colon = strrchr(endpoint, ':')) || colon == endpoint ||
+	    colon - endpoint >= sizeof(host)) {
+		fprintf(stderr, "tcp: endpoint must be of the form host:port\n");
+		return -EINVAL;
+	}
+	memcpy(host, endpoint, colon - endpoint);
+	host[colon - endpoint] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((ret = getaddrinfo(host, colon + 1, &hints, &res)) != 0) {
+		fprintf(stderr, "tcp: cannot resolve %s: %s\n", endpoint, gai_strerror(ret));
+		return -EAGAIN;
+	}
+
+	fd = -ECONNREFUSED;
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			fd = -errno;
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		ret = -errno;
+		close(fd);
+		fd = ret;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s node host:port\n\n"
+		"Forward every new sample of node, e.g. /dev/lunix0-temp,\n"
+		"to host:port, using splice().\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, sock, pfd[2], mode = LUNIX_MODE_STREAM;
+	unsigned long long bytes = 0, calls = 0;
+	struct sigaction sa;
+	ssize_t n, m;
+
+	if (argc != 3)
+		usage(argv[0]);
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+	if (ioctl(fd, LUNIX_IOC_SET_MODE, &mode) < 0) {
+		perror("LUNIX_IOC_SET_MODE: streaming mode");
+		exit(1);
+	}
+	if ((sock = tcp_connect(argv[2])) < 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(-sock));
+		exit(1);
+	}
+	if (pipe(pfd) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	/* No SA_RESTART: a signal must get us out of a blocked splice() */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_catch;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!stop) {
+		/* Blocks until there is at least one new sample, then drains them all */
+		n = splice(fd, NULL, pfd[1], NULL, FORWARD_CHUNK, SPLICE_F_MOVE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("splice from node");
+			break;
+		}
+		calls++;
+		bytes += n;
+
+		while (n > 0) {
+			/*
+			 * No SPLICE_F_MORE: it would hold back the tail of the
+			 * batch until the next sample; the kernel sets MSG_MORE
+			 * itself while the pipe still holds more of it.
+			 */
+			m = splice(pfd[0], NULL, sock, NULL, n, SPLICE_F_MOVE);
+			if (m < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("splice to socket");
+				stop = 1;
+				break;
+			}
+			n -= m;
+		}
+	}
+
+	fprintf(stderr, "%llu samples in %llu splice calls, %.1f samples per call\n",
+		bytes / sizeof(struct lunix_history_sample), calls,
+		calls ? (double)bytes / sizeof(struct lunix_history_sample) / calls : 0.0);
+	close(sock);
+	close(fd);
+	return 0;
+}
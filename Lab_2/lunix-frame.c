@@ -0,0 +1,77 @@
+/*
+ * lunix-frame.c
+ *
+ * Construction of synthetic XMesh sensor packets.
+ *
+ */
+
+#include <string.h>
+
+#include "lunix-frame.h"
+
+#define XMESH_SYNC		0x7E
+#define XMESH_ESCAPE		0x7D
+#define XMESH_PACKET_TYPE	0x42	/* no acknowledgement required */
+#define XMESH_AM_SENSOR		0x0B	/* see lunix_protocol_update_sensors() */
+
+/* Offsets inside the payload, cf. the *_OFFSET constants of lunix-protocol.h */
+#define PAYLOAD_NODE		2
+#define PAYLOAD_VREF		11
+#define PAYLOAD_TEMPERATURE	13
+#define PAYLOAD_LIGHT		15
+
+/* CRC-16/CCITT, as computed by TinyOS motes */
+static uint16_t crc_byte(uint16_t crc, unsigned char b)
+{
+	int i;
+
+	crc ^= (uint16_t)b << 8;
+	for (i = 0; i < 8; i++)
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	return crc;
+}
+
+static void put_le16(unsigned char *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+size_t lunix_frame_build(unsigned char *buf, uint16_t node,
+	uint16_t batt, uint16_t temp, uint16_t light)
+{
+	size_t i, len, n = 0;
+	uint16_t crc = 0;
+	unsigned char raw[1 + 5 + LUNIX_FRAME_PAYLOAD + 2];
+
+	/* Packet type, destination, AM type, AM group, payload length */
+	memset(raw, 0, sizeof(raw));
+	raw[0] = XMESH_PACKET_TYPE;
+	raw[1] = raw[2] = 0xff;
+	raw[3] = XMESH_AM_SENSOR;
+	raw[4] = 0x7d;			/* default TinyOS group */
+	raw[5] = LUNIX_FRAME_PAYLOAD;
+	put_le16(&raw[6 + PAYLOAD_NODE], node);
+	put_le16(&raw[6 + PAYLOAD_VREF], batt);
+	put_le16(&raw[6 + PAYLOAD_TEMPERATURE], temp);
+	put_le16(&raw[6 + PAYLOAD_LIGHT], light);
+
+	len = 6 + LUNIX_FRAME_PAYLOAD;
+	for (i = 0; i < len; i++)
+		crc = crc_byte(crc, raw[i]);
+	put_le16(&raw[len], crc);
+	len += 2;
+
+	/* Everything between the sync bytes is escaped */
+	buf[n++] = XMESH_SYNC;
+	for (i = 0; i < len; i++) {
+		if (raw[i] == XMESH_SYNC || raw[i] == XMESH_ESCAPE) {
+			buf[n++] = XMESH_ESCAPE;
+			buf[n++] = raw[i] ^ 0x20;
+		} else
+			buf[n++] = raw[i];
+	}
+	buf[n++] = XMESH_SYNC;
+
+	return n;
+}
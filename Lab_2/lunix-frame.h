@@ -0,0 +1,28 @@
+/*
+ * lunix-frame.h
+ *
+ * Construction of synthetic XMesh sensor packets, as a base station
+ * would emit them, for test and benchmark tools. See lunix-protocol.c
+ * for the packet structure.
+ *
+ */
+
+#ifndef _LUNIX_FRAME_H
+#define _LUNIX_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LUNIX_FRAME_PAYLOAD	17	/* shortest payload carrying all of light */
+
+/* Room for a packet with every byte between the start and end bytes escaped */
+#define LUNIX_FRAME_MAXLEN	(2 + 2 * (1 + 5 + LUNIX_FRAME_PAYLOAD + 2))
+
+/*
+ * Build a sensor packet for node [1-based sensor number] into buf,
+ * which must hold LUNIX_FRAME_MAXLEN bytes. Returns its length.
+ */
+size_t lunix_frame_build(unsigned char *buf, uint16_t node,
+	uint16_t batt, uint16_t temp, uint16_t light);
+
+#endif	/* _LUNIX_FRAME_H */
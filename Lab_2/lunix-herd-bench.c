@@ -0,0 +1,235 @@
+/*
+ * lunix-herd-bench.c
+ *
+ * Thundering herd benchmark: 1 to 64 threads block in read() on one
+ * shared open Lunix:TNG node, while packets for its sensor are fed
+ * through the injection device at a fixed rate. Each run is done with
+ * ordinary and with exclusive waiters [LUNIX_MODE_EXCLUSIVE], and
+ * reports the context switches the readers paid per sample delivered.
+ *
+ * Then two open files of the same sensor, the node and the next
+ * measurement's, each get a pool of exclusive readers: every packet
+ * must get through to both pools, not just to whichever woke first.
+ *
+ * Needs the module loaded, /dev/lunix-inject and CAP_SYS_ADMIN.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include "lunix.h"
+#include "lunix-chrdev.h"
+#include "lunix-inject.h"
+#include "lunix-frame.h"
+
+#define HERD_MAX_THREADS	64
+#define HERD_MAX_FILES		2
+
+static const char *msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+static volatile int stop;
+
+struct feeder {
+	int fd;
+	unsigned int sensor;
+	unsigned long rate;
+	unsigned long sent;
+	long csw;		/* its own context switches, to subtract */
+};
+
+static long csw_of(int who)
+{
+	struct rusage ru;
+
+	getrusage(who, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void *feeder_main(void *arg)
+{
+	size_t len;
+	struct timespec ts;
+	struct feeder *f = arg;
+	unsigned char buf[LUNIX_FRAME_MAXLEN];
+	long csw0 = csw_of(RUSAGE_THREAD);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	while (!stop) {
+		ts.tv_nsec += 1000000000 / f->rate;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		len = lunix_frame_build(buf, f->sensor + 1, f->sent, f->sent, f->sent);
+		if (write(f->fd, buf, len) != len) {
+			perror("write");
+			break;
+		}
+		f->sent++;
+	}
+	f->csw = csw_of(RUSAGE_THREAD) - csw0;
+	return NULL;
+}
+
+static int nfiles, node_fd[HERD_MAX_FILES];
+static unsigned long delivered[HERD_MAX_THREADS];
+
+/* Reader i of a run, on open file i % nfiles */
+static void *reader_main(void *arg)
+{
+	long i = (long)arg;
+	struct lunix_sample s;
+
+	while (!stop) {
+		if (read(node_fd[i % nfiles], &s, sizeof(s)) == sizeof(s))
+			delivered[i]++;
+		else if (errno != EINTR)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * One run: nthreads readers spread over one open file of each of the
+ * nodes, for secs seconds. Returns switches per sample; the samples
+ * delivered through each file go to samples[].
+ */
+static double run(const char **nodes, int nnodes, struct feeder *f, int nthreads,
+	int exclusive, int secs, unsigned long *samples)
+{
+	int mode = LUNIX_MODE_BINARY | (exclusive ? LUNIX_MODE_EXCLUSIVE : 0);
+	pthread_t feeder, readers[HERD_MAX_THREADS];
+	unsigned long total;
+	long i, csw0, csw;
+
+	nfiles = nnodes;
+	for (i = 0; i < nfiles; i++) {
+		node_fd[i] = open(nodes[i], O_RDONLY);
+		if (node_fd[i] < 0 || ioctl(node_fd[i], LUNIX_IOC_SET_MODE, &mode) < 0) {
+			perror(nodes[i]);
+			exit(1);
+		}
+	}
+	memset(delivered, 0, sizeof(delivered));
+	stop = 0;
+	f->sent = 0;
+
+	csw0 = csw_of(RUSAGE_SELF);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&readers[i], NULL, reader_main, (void *)i);
+	pthread_create(&feeder, NULL, feeder_main, f);
+
+	sleep(secs);
+	stop = 1;
+	pthread_join(feeder, NULL);
+
+	/* One last packet, to release the readers still waiting */
+	for (i = 0; i < nthreads; i++) {
+		unsigned char buf[LUNIX_FRAME_MAXLEN];
+		size_t len = lunix_frame_build(buf, f->sensor + 1, 0, 0, 0);
+
+		if (write(f->fd, buf, len) != len)
+			perror("write");
+		usleep(1000);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(readers[i], NULL);
+	csw = csw_of(RUSAGE_SELF) - csw0 - f->csw;
+	for (i = 0; i < nfiles; i++) {
+		close(node_fd[i]);
+		samples[i] = 0;
+	}
+
+	for (total = 0, i = 0; i < nthreads; i++) {
+		samples[i % nfiles] += delivered[i];
+		total += delivered[i];
+	}
+	return total ? (double)csw / total : 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s sensor] [-t batt|temp|light] [-r rate] [-d seconds]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, n, type = TEMP, secs = 2;
+	unsigned long s_shared, s_excl, s_two[HERD_MAX_FILES];
+	double c_shared, c_excl;
+	struct feeder f = { .sensor = 0, .rate = 1000 };
+	char node[64], node2[64];
+	const char *nodes[HERD_MAX_FILES] = { node, node2 };
+
+	while ((opt = getopt(argc, argv, "s:t:r:d:")) != -1) {
+		switch (opt) {
+		case 's':
+			f.sensor = atoi(optarg);
+			break;
+		case 't':
+			for (type = 0; type < N_LUNIX_MSR; type++)
+				if (!strcmp(optarg, msr_names[type]))
+					break;
+			if (type == N_LUNIX_MSR)
+				usage(argv[0]);
+			break;
+		case 'r':
+			f.rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (f.rate == 0 || secs <= 0)
+		usage(argv[0]);
+
+	snprintf(node, sizeof(node), "/dev/lunix%u-%s", f.sensor, msr_names[type]);
+	snprintf(node2, sizeof(node2), "/dev/lunix%u-%s", f.sensor,
+		msr_names[(type + 1) % N_LUNIX_MSR]);
+	f.fd = open(LUNIX_INJECT_PATH, O_WRONLY);
+	if (f.fd < 0) {
+		perror(LUNIX_INJECT_PATH);
+		exit(1);
+	}
+
+	printf("%s, %lu packets/s, %d s per run\n", node, f.rate, secs);
+	printf("%8s %14s %14s %14s %14s\n", "threads", "samples", "csw/sample",
+		"samples excl", "csw/sample excl");
+	for (n = 1; n <= HERD_MAX_THREADS; n *= 2) {
+		c_shared = run(nodes, 1, &f, n, 0, secs, &s_shared);
+		c_excl = run(nodes, 1, &f, n, 1, secs, &s_excl);
+		printf("%8d %14lu %14.2f %14lu %14.2f\n", n, s_shared, c_shared, s_excl, c_excl);
+	}
+
+	/* Each pool should see about every packet, whatever the other one does */
+	printf("\nexclusive readers on %s and %s\n", node, node2);
+	printf("%8s %14s %14s %14s %14s\n", "threads", "packets", "samples", "samples 2",
+		"csw/sample");
+	for (n = 2; n <= HERD_MAX_THREADS; n *= 2) {
+		c_excl = run(nodes, HERD_MAX_FILES, &f, n, 1, secs, s_two);
+		printf("%8d %14lu %14lu %14lu %14.2f\n", n, f.sent, s_two[0], s_two[1], c_excl);
+	}
+
+	close(f.fd);
+	return 0;
+}
@@ -0,0 +1,543 @@
+/*
+ * lunix-history.c
+ *
+ * Compressed long-term measurement history for Lunix:TNG
+ *
+ * Samples are appended by lunix_sensor_update(), with the sensor
+ * spinlock held, so chunk pages are allocated with GFP_ATOMIC.
+ * Readers decode under the same spinlock into a bounce buffer,
+ * a batch at a time, and copy out after dropping it.
+ *
+ * Every chunk also keeps a summary [min, max, sum, count] of the
+ * converted values it holds, and a segment tree over the chunk slots
+ * answers time-range queries [LUNIX_IOC_QUERY] in O(log n).
+ *
+ */
+
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/spinlock.h>
+
+#include "lunix.h"
+#include "lunix-chrdev.h"
+#include "lunix-history.h"
+
+/*
+ * Memory budget for the history of every sensor, shared equally
+ * among its measurements. 0 disables history.
+ */
+static unsigned int lunix_history_kb = 96;
+module_param(lunix_history_kb, uint, 0);
+MODULE_PARM_DESC(lunix_history_kb, "History memory budget per sensor, in KiB [0: no history]");
+
+/* Largest encoding of a sample: two 64-bit varints */
+#define LUNIX_HISTORY_MAXENC	20
+
+/* Records decoded per batch, under the sensor spinlock */
+#define LUNIX_HISTORY_BATCH	(PAGE_SIZE / sizeof(struct lunix_history_sample))
+
+static inline uint64_t zigzag_encode(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int varint_put(unsigned char *p, uint64_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns the bytes consumed, 0 if the varint runs past end */
+static int varint_get(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+	int n = 0, shift = 0;
+
+	*v = 0;
+	while (p + n < end && shift < 64) {
+		*v |= (uint64_t)(p[n] & 0x7f) << shift;
+		if (!(p[n++] & 0x80))
+			return n;
+		shift += 7;
+	}
+	return 0;
+}
+
+/*
+ * Decode the sample at off of chunk c, on top of the previous
+ * one in *ms, *raw. Returns the bytes consumed, 0 if corrupt.
+ */
+static int lunix_history_decode_one(const struct lunix_history_chunk *c, uint32_t off,
+	uint64_t *ms, uint32_t *raw)
+{
+	int n, m;
+	uint64_t dms, draw;
+
+	n = varint_get(c->data + off, c->data + c->used, &dms);
+	if (!n)
+		return 0;
+	m = varint_get(c->data + off + n, c->data + c->used, &draw);
+	if (!m)
+		return 0;
+
+	*ms += zigzag_decode(dms);
+	*raw += zigzag_decode(draw);
+	return n + m;
+}
+
+static int lunix_history_encode(unsigned char *p, uint64_t prev_ms, uint32_t prev_raw,
+	uint64_t ms, uint32_t raw)
+{
+	int n;
+
+	n = varint_put(p, zigzag_encode((int64_t)(ms - prev_ms)));
+	n += varint_put(p + n, zigzag_encode((int64_t)raw - (int64_t)prev_raw));
+	return n;
+}
+
+static inline struct lunix_history_chunk *
+lunix_history_chunk(const struct lunix_history_struct *h, uint64_t id)
+{
+	uint64_t first_id = h->next_id - h->cnt;
+
+	if (id < first_id || id >= h->next_id)
+		return NULL;
+	return h->chunks[(h->head + (id - first_id)) % h->nr_chunks];
+}
+
+/* The i-th chunk in time order, 0 <= i < h->cnt */
+static inline struct lunix_history_chunk *
+lunix_history_nth(const struct lunix_history_struct *h, unsigned int i)
+{
+	return h->chunks[(h->head + i) % h->nr_chunks];
+}
+
+/*
+ * Summaries of converted values
+ */
+static inline void lunix_summary_reset(struct lunix_history_summary *s)
+{
+	s->sum = 0;
+	s->count = 0;
+	s->min = S32_MAX;
+	s->max = S32_MIN;
+}
+
+static inline void lunix_summary_add(struct lunix_history_summary *s, int32_t value)
+{
+	s->sum += value;
+	s->count++;
+	s->min = min(s->min, value);
+	s->max = max(s->max, value);
+}
+
+static inline void lunix_summary_merge(struct lunix_history_summary *s,
+	const struct lunix_history_summary *o)
+{
+	s->sum += o->sum;
+	s->count += o->count;
+	s->min = min(s->min, o->min);
+	s->max = max(s->max, o->max);
+}
+
+/* Refresh the leaf of slot, and its ancestors */
+static void lunix_history_tree_update(struct lunix_history_struct *h, unsigned int slot)
+{
+	unsigned int i = h->tree_leaves + slot;
+
+	h->tree[i] = h->chunks[slot]->summary;
+	for (i /= 2; i >= 1; i /= 2) {
+		h->tree[i] = h->tree[2 * i];
+		lunix_summary_merge(&h->tree[i], &h->tree[2 * i + 1]);
+	}
+}
+
+/* Merge the summaries of slots [l, r] into res */
+static void lunix_history_tree_query(const struct lunix_history_struct *h,
+	unsigned int l, unsigned int r, struct lunix_history_summary *res)
+{
+	l += h->tree_leaves;
+	r += h->tree_leaves + 1;
+	while (l < r) {
+		if (l & 1)
+			lunix_summary_merge(res, &h->tree[l++]);
+		if (r & 1)
+			lunix_summary_merge(res, &h->tree[--r]);
+		l /= 2;
+		r /= 2;
+	}
+}
+
+/* Merge the summaries of the chunks in time order [lo, hi] into res */
+static void lunix_history_range_query(const struct lunix_history_struct *h,
+	unsigned int lo, unsigned int hi, struct lunix_history_summary *res)
+{
+	unsigned int l = (h->head + lo) % h->nr_chunks;
+	unsigned int r = (h->head + hi) % h->nr_chunks;
+
+	if (l <= r)
+		lunix_history_tree_query(h, l, r, res);
+	else {
+		lunix_history_tree_query(h, l, h->nr_chunks - 1, res);
+		lunix_history_tree_query(h, 0, r, res);
+	}
+}
+
+/* Add the samples of chunk c in [from_ms, to_ms) to res, by decoding it */
+static void lunix_history_scan(const struct lunix_history_chunk *c, enum lunix_msr_enum type,
+	uint64_t from_ms, uint64_t to_ms, struct lunix_history_summary *res)
+{
+	int n;
+	uint32_t off = 0, raw = c->first_raw;
+	uint64_t ms = c->first_ms;
+
+	while (off < c->used && (n = lunix_history_decode_one(c, off, &ms, &raw))) {
+		off += n;
+		if (ms >= from_ms && ms < to_ms)
+			lunix_summary_add(res, (int32_t)lunix_msr_convert(type, raw));
+	}
+}
+
+/*
+ * Summarize the samples with from_ms <= timestamp < to_ms.
+ * Called with the sensor spinlock held.
+ */
+void lunix_history_query(const struct lunix_history_struct *h, enum lunix_msr_enum type,
+	uint64_t from_ms, uint64_t to_ms, struct lunix_history_summary *res)
+{
+	unsigned int lo, hi, l, r, m;
+	struct lunix_history_chunk *c;
+
+	lunix_summary_reset(res);
+	if (!h->cnt || from_ms >= to_ms)
+		return;
+
+	/* lo: first chunk ending at or after from_ms */
+	for (l = 0, r = h->cnt; l < r; ) {
+		m = l + (r - l) / 2;
+		if (lunix_history_nth(h, m)->last_ms < from_ms)
+			l = m + 1;
+		else
+			r = m;
+	}
+	lo = l;
+
+	/* hi + 1: first chunk starting at or after to_ms */
+	for (l = lo, r = h->cnt; l < r; ) {
+		m = l + (r - l) / 2;
+		if (lunix_history_nth(h, m)->first_ms < to_ms)
+			l = m + 1;
+		else
+			r = m;
+	}
+	if (l == lo)
+		return;
+	hi = l - 1;
+
+	/* The chunks in between lie entirely within the range */
+	c = lunix_history_nth(h, lo);
+	if (c->first_ms >= from_ms && c->last_ms < to_ms)
+		lunix_summary_merge(res, &c->summary);
+	else
+		lunix_history_scan(c, type, from_ms, to_ms, res);
+	if (hi == lo)
+		return;
+	if (hi > lo + 1)
+		lunix_history_range_query(h, lo + 1, hi - 1, res);
+	c = lunix_history_nth(h, hi);
+	if (c->last_ms < to_ms)
+		lunix_summary_merge(res, &c->summary);
+	else
+		lunix_history_scan(c, type, from_ms, to_ms, res);
+}
+
+/*
+ * Start a new chunk: a fresh page while within budget,
+ * the oldest chunk otherwise.
+ */
+static struct lunix_history_chunk *lunix_history_new_chunk(struct lunix_history_struct *h)
+{
+	unsigned int slot;
+	struct lunix_history_chunk *c;
+
+	if (h->cnt < h->nr_chunks) {
+		slot = (h->head + h->cnt) % h->nr_chunks;
+		if (!h->chunks[slot]) {
+			h->chunks[slot] = (void *)__get_free_page(GFP_ATOMIC | __GFP_NOWARN);
+			if (!h->chunks[slot])
+				return NULL;
+		}
+		h->cnt++;
+	} else {
+		slot = h->head;
+		h->head = (h->head + 1) % h->nr_chunks;
+	}
+
+	c = h->chunks[slot];
+	c->id = h->next_id++;
+	c->count = 0;
+	c->used = 0;
+	lunix_summary_reset(&c->summary);
+	return c;
+}
+
+void lunix_history_append(struct lunix_history_struct *h, uint64_t ms,
+	uint16_t raw, int32_t value)
+{
+	int n = 0;
+	unsigned char enc[LUNIX_HISTORY_MAXENC];
+	struct lunix_history_chunk *c;
+
+	if (!h->nr_chunks)
+		return;
+
+	c = h->cnt ? lunix_history_chunk(h, h->next_id - 1) : NULL;
+
+	/*
+	 * ms is wall clock time, which steps back now and then [NTP,
+	 * settimeofday()]. Queries search the chunks by time and take
+	 * whole chunk summaries, and need it to never decrease: a
+	 * sample from before the last one counts as taken with it.
+	 */
+	if (c && ms < c->last_ms)
+		ms = c->last_ms;
+	if (c)
+		n = lunix_history_encode(enc, c->last_ms, c->last_raw, ms, raw);
+	if (!c || c->used + n > LUNIX_HISTORY_CHUNK_DATA) {
+		c = lunix_history_new_chunk(h);
+		if (!c) {
+			h->dropped++;
+			return;
+		}
+		c->first_ms = ms;
+		c->first_raw = raw;
+		n = lunix_history_encode(enc, ms, raw, ms, raw);
+	}
+
+	memcpy(c->data + c->used, enc, n);
+	c->used += n;
+	c->count++;
+	c->last_ms = ms;
+	c->last_raw = raw;
+	lunix_summary_add(&c->summary, value);
+	lunix_history_tree_update(h, (h->head + h->cnt - 1) % h->nr_chunks);
+	h->samples++;
+}
+
+/* Memory held by the history, in bytes */
+size_t lunix_history_bytes(const struct lunix_history_struct *h)
+{
+	unsigned int i;
+	size_t bytes = 0;
+
+	for (i = 0; i < h->nr_chunks; i++)
+		if (h->chunks[i])
+			bytes += PAGE_SIZE;
+	return bytes;
+}
+
+void lunix_history_rewind(struct lunix_history_cursor *pos)
+{
+	memset(pos, 0, sizeof(*pos));
+}
+
+/* Position pos after the newest sample, for readers of what comes next */
+void lunix_history_seek_end(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	struct lunix_history_cursor *pos)
+{
+	unsigned long flags;
+	struct lunix_history_chunk *c;
+	struct lunix_history_struct *h = &s->hist[type];
+
+	spin_lock_irqsave(&s->lock, flags);
+	c = h->cnt ? lunix_history_chunk(h, h->next_id - 1) : NULL;
+	if (c) {
+		pos->id = c->id;
+		pos->off = c->used;
+		pos->ms = c->last_ms;
+		pos->raw = c->last_raw;
+	} else {
+		/* Nothing yet: start with the first chunk there will be */
+		lunix_history_rewind(pos);
+		pos->id = h->next_id;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+/* Has the reader at pos decoded every sample there is? */
+bool lunix_history_caught_up(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	const struct lunix_history_cursor *pos)
+{
+	bool ret;
+	unsigned long flags;
+	struct lunix_history_chunk *c;
+	struct lunix_history_struct *h = &s->hist[type];
+
+	spin_lock_irqsave(&s->lock, flags);
+	c = h->cnt ? lunix_history_chunk(h, h->next_id - 1) : NULL;
+	ret = !c || (pos->id == c->id && pos->off >= c->used) || pos->id > c->id;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return ret;
+}
+
+/*
+ * Decode up to max samples at pos into out. Returns the number
+ * of samples decoded, 0 at the end of the history.
+ * Called with the sensor spinlock held.
+ */
+static size_t lunix_history_decode(const struct lunix_history_struct *h, enum lunix_msr_enum type,
+	struct lunix_history_cursor *pos, struct lunix_history_sample *out, size_t max)
+{
+	int n;
+	size_t done = 0;
+	uint64_t first_id;
+	struct lunix_history_chunk *c;
+
+	if (!h->cnt)
+		return 0;
+
+	/* Overtaken by recycling? Resume from the oldest chunk there is. */
+	first_id = h->next_id - h->cnt;
+	if (pos->id < first_id) {
+		pos->id = first_id;
+		pos->off = 0;
+	}
+
+	while (done < max && (c = lunix_history_chunk(h, pos->id))) {
+		if (pos->off == 0) {
+			pos->ms = c->first_ms;
+			pos->raw = c->first_raw;
+		}
+		if (pos->off >= c->used) {
+			/* Done with this chunk; move on, unless it is the newest */
+			if (pos->id + 1 == h->next_id)
+				break;
+			pos->id++;
+			pos->off = 0;
+			continue;
+		}
+
+		n = lunix_history_decode_one(c, pos->off, &pos->ms, &pos->raw);
+		if (!n) {
+			WARN_ON_ONCE(1);
+			pos->off = c->used;
+			continue;
+		}
+		pos->off += n;
+
+		out[done].timestamp_ms = pos->ms;
+		out[done].raw = pos->raw;
+		out[done].value = (int32_t)lunix_msr_convert(type, pos->raw);
+		done++;
+	}
+
+	return done;
+}
+
+/*
+ * Stream decoded history from pos, as struct lunix_history_sample
+ * records. Returns 0 once the reader has caught up; the next read()
+ * continues with whatever arrived meanwhile.
+ */
+ssize_t lunix_history_read(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	struct lunix_history_cursor *pos, struct iov_iter *to)
+{
+	size_t cnt = iov_iter_count(to);
+	size_t max, done;
+	ssize_t total = 0;
+	unsigned long flags;
+	struct lunix_history_sample *bounce;
+
+	if (cnt < sizeof(*bounce))
+		return -EINVAL;
+
+	bounce = (struct lunix_history_sample *)__get_free_page(GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	while (cnt >= sizeof(*bounce)) {
+		max = min(cnt / sizeof(*bounce), LUNIX_HISTORY_BATCH);
+
+		spin_lock_irqsave(&s->lock, flags);
+		done = lunix_history_decode(&s->hist[type], type, pos, bounce, max);
+		spin_unlock_irqrestore(&s->lock, flags);
+
+		if (!done)
+			break;
+		if (copy_to_iter(bounce, done * sizeof(*bounce), to) != done * sizeof(*bounce)) {
+			if (!total)
+				total = -EFAULT;
+			break;
+		}
+		total += done * sizeof(*bounce);
+		cnt -= done * sizeof(*bounce);
+	}
+
+	free_page((unsigned long)bounce);
+	return total;
+}
+
+int lunix_history_init(struct lunix_history_struct *h)
+{
+	unsigned int i;
+
+	memset(h, 0, sizeof(*h));
+
+	h->nr_chunks = lunix_history_kb * 1024 / PAGE_SIZE / N_LUNIX_MSR;
+	if (!h->nr_chunks)
+		return 0;
+	/* Recycling needs a chunk to go on filling */
+	if (h->nr_chunks < 2)
+		h->nr_chunks = 2;
+
+	h->chunks = kcalloc(h->nr_chunks, sizeof(*h->chunks), GFP_KERNEL);
+	if (!h->chunks)
+		goto out_nomem;
+
+	h->tree_leaves = roundup_pow_of_two(h->nr_chunks);
+	h->tree = kcalloc(2 * h->tree_leaves, sizeof(*h->tree), GFP_KERNEL);
+	if (!h->tree)
+		goto out_nomem;
+	for (i = 0; i < 2 * h->tree_leaves; i++)
+		lunix_summary_reset(&h->tree[i]);
+	return 0;
+
+out_nomem:
+	kfree(h->chunks);
+	h->chunks = NULL;
+	h->nr_chunks = 0;
+	return -ENOMEM;
+}
+
+void lunix_history_destroy(struct lunix_history_struct *h)
+{
+	unsigned int i;
+
+	if (!h->chunks)
+		return;
+	for (i = 0; i < h->nr_chunks; i++)
+		if (h->chunks[i])
+			free_page((unsigned long)h->chunks[i]);
+	kfree(h->chunks);
+	kfree(h->tree);
+	h->chunks = NULL;
+	h->tree = NULL;
+	h->nr_chunks = 0;
+}
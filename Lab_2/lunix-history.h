@@ -0,0 +1,112 @@
+/*
+ * lunix-history.h
+ *
+ * Definition file for the
+ * Lunix:TNG compressed measurement history
+ *
+ */
+
+#ifndef _LUNIX_HISTORY_H
+#define _LUNIX_HISTORY_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+
+/*
+ * History is kept in page-sized chunks. Every sample is encoded as
+ * the difference from the previous one, timestamp first, then raw
+ * value, each as a zigzag LEB128 varint: readings that barely change,
+ * arriving every few hundred msec, cost 2-3 bytes instead of 12.
+ * The first sample of a chunk is encoded against the chunk's
+ * first_ms/first_raw, so every chunk decodes on its own.
+ */
+
+/*
+ * Summary of the converted values of a run of samples:
+ * a chunk, or a node of the index built over the chunks.
+ */
+struct lunix_history_summary {
+	int64_t sum;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+};
+
+struct lunix_history_chunk {
+	uint64_t id;		/* sequence number of the chunk */
+	uint64_t first_ms;	/* first sample, msec since the Epoch */
+	uint64_t last_ms;	/* last sample */
+	uint32_t first_raw;
+	uint32_t last_raw;
+	uint32_t count;		/* samples in data[] */
+	uint32_t used;		/* bytes of data[] in use */
+	struct lunix_history_summary summary;
+	unsigned char data[];
+};
+
+#define LUNIX_HISTORY_CHUNK_DATA	(PAGE_SIZE - sizeof(struct lunix_history_chunk))
+
+/*
+ * History of one measurement: a ring of at most nr_chunks chunks,
+ * allocated as they are needed. Once the memory budget is used up,
+ * the oldest chunk is recycled. Protected by the sensor spinlock.
+ *
+ * tree[] is a segment tree over the slots of chunks[]: leaf
+ * tree_leaves + slot holds the summary of the chunk in that slot,
+ * every inner node the merged summaries of its children. Chunks are
+ * in time order, so a time range covers a run of whole chunks, found
+ * by binary search, plus at most two partial ones at its ends: queries
+ * cost O(log n) summaries and decoding two chunks, whatever the range.
+ */
+struct lunix_history_struct {
+	struct lunix_history_chunk **chunks;
+	unsigned int nr_chunks;		/* size of chunks[], the budget */
+	unsigned int head;		/* slot of the oldest chunk */
+	unsigned int cnt;		/* chunks in use */
+	uint64_t next_id;		/* id of the next chunk to fill */
+
+	struct lunix_history_summary *tree;
+	unsigned int tree_leaves;	/* power of 2, >= nr_chunks */
+
+	unsigned long samples;		/* samples ever appended */
+	unsigned long dropped;		/* samples lost to failed allocations */
+};
+
+/*
+ * Read position of a history reader, see lunix_history_read().
+ * Chunk ids only grow, so a reader overtaken by recycling notices.
+ */
+struct lunix_history_cursor {
+	uint64_t id;		/* chunk */
+	uint32_t off;		/* byte offset in its data[] */
+	uint64_t ms;		/* last sample decoded */
+	uint32_t raw;
+};
+
+struct lunix_sensor_struct;
+
+/*
+ * Function prototypes
+ */
+int lunix_history_init(struct lunix_history_struct *h);
+void lunix_history_destroy(struct lunix_history_struct *h);
+void lunix_history_append(struct lunix_history_struct *h, uint64_t ms,
+	uint16_t raw, int32_t value);
+struct iov_iter;
+
+void lunix_history_rewind(struct lunix_history_cursor *pos);
+void lunix_history_seek_end(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	struct lunix_history_cursor *pos);
+bool lunix_history_caught_up(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	const struct lunix_history_cursor *pos);
+ssize_t lunix_history_read(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+	struct lunix_history_cursor *pos, struct iov_iter *to);
+size_t lunix_history_bytes(const struct lunix_history_struct *h);
+void lunix_history_query(const struct lunix_history_struct *h, enum lunix_msr_enum type,
+	uint64_t from_ms, uint64_t to_ms, struct lunix_history_summary *res);
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LUNIX_HISTORY_H */
@@ -0,0 +1,143 @@
+/*
+ * lunix-inject.c
+ *
+ * Direct injection device for Lunix:TNG
+ *
+ * Raw XMesh data written to /dev/lunix-inject are passed
+ * to a private protocol state machine, exactly as if they had
+ * been received by the line discipline, but without going through
+ * a pty, the TTY flip buffers and the ldisc.
+ *
+ */
+
+#include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/miscdevice.h>
+
+#include "lunix.h"
+#include "lunix-inject.h"
+#include "lunix-protocol.h"
+
+static int lunix_inject_open(struct inode *inode, struct file *filp)
+{
+	int ret;
+	struct lunix_inject_state_struct *state;
+
+	debug("entering\n");
+
+	/* Same policy as attaching the line discipline to a TTY */
+	ret = -EPERM;
+	if (!capable(CAP_SYS_ADMIN))
+		goto out;
+
+	/* Write-only node */
+	ret = -EINVAL;
+	if (filp->f_mode & FMODE_READ)
+		goto out;
+
+	if ((ret = nonseekable_open(inode, filp)) < 0)
+		goto out;
+
+	ret = -ENOMEM;
+	state = kmalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		goto out;
+	state->buf = (unsigned char *)__get_free_page(GFP_KERNEL);
+	if (!state->buf) {
+		kfree(state);
+		goto out;
+	}
+	lunix_protocol_init(&state->proto);
+	mutex_init(&state->lock);
+
+	filp->private_data = state;
+	ret = 0;
+out:
+	debug("leaving, with ret = %d\n", ret);
+	return ret;
+}
+
+static int lunix_inject_release(struct inode *inode, struct file *filp)
+{
+	struct lunix_inject_state_struct *state = filp->private_data;
+
+	free_page((unsigned long)state->buf);
+	kfree(state);
+	return 0;
+}
+
+/*
+ * Large batched writes are consumed one page at a time,
+ * so a single write() may carry any number of packets.
+ */
+static ssize_t lunix_inject_write(struct file *filp, const char __user *usrbuf,
+	size_t cnt, loff_t *f_pos)
+{
+	size_t done, chunk;
+	ssize_t ret;
+	struct lunix_inject_state_struct *state = filp->private_data;
+
+	WARN_ON(!state);
+
+	if (cnt == 0)
+		return 0;
+	if (mutex_lock_interruptible(&state->lock))
+		return -ERESTARTSYS;
+
+	ret = 0;
+	for (done = 0; done < cnt; done += chunk) {
+		chunk = min_t(size_t, cnt - done, LUNIX_INJECT_BUFSZ);
+		if (copy_from_user(state->buf, usrbuf + done, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+		lunix_protocol_received_buf(&state->proto, state->buf, chunk);
+		cond_resched();
+	}
+
+	mutex_unlock(&state->lock);
+
+	/* Report a partial write if only part of the buffer was readable */
+	return done ? done : ret;
+}
+
+static struct file_operations lunix_inject_fops = 
+{
+	.owner          = THIS_MODULE,
+	.open           = lunix_inject_open,
+	.release        = lunix_inject_release,
+	.write          = lunix_inject_write,
+	.llseek         = no_llseek
+};
+
+static struct miscdevice lunix_inject_miscdev = {
+	.minor          = MISC_DYNAMIC_MINOR,
+	.name           = LUNIX_INJECT_NAME,
+	.fops           = &lunix_inject_fops,
+	.mode           = S_IWUSR
+};
+
+int lunix_inject_init(void)
+{
+	int ret;
+
+	debug("registering injection device\n");
+	ret = misc_register(&lunix_inject_miscdev);
+	if (ret)
+		printk(KERN_ERR "%s: Error registering injection device, ret = %d.\n", __FILE__, ret);
+
+	debug("leaving with ret = %d\n", ret);
+	return ret;
+}
+
+void lunix_inject_destroy(void)
+{
+	debug("unregistering injection device\n");
+	misc_deregister(&lunix_inject_miscdev);
+}
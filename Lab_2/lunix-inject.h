@@ -0,0 +1,51 @@
+/*
+ * lunix-inject.h
+ *
+ * Definition file for the
+ * Lunix:TNG direct injection device
+ *
+ */
+
+#ifndef _LUNIX_INJECT_H
+#define _LUNIX_INJECT_H
+
+/*
+ * Lunix:TNG injection device: a privileged, write-only node,
+ * bytes written to it are fed straight to the protocol state machine,
+ * bypassing the TTY layer and the line discipline.
+ */
+#define LUNIX_INJECT_NAME	"lunix-inject"
+#define LUNIX_INJECT_PATH	"/dev/" LUNIX_INJECT_NAME
+
+#ifdef __KERNEL__
+
+#define LUNIX_INJECT_BUFSZ	PAGE_SIZE	/* Bytes copied from userspace per chunk */
+
+#include <linux/mutex.h>
+
+#include "lunix-protocol.h"
+
+/*
+ * Private state for an open injection node.
+ * Every writer gets its own protocol state, so independent
+ * streams do not corrupt each other's partially received packets.
+ */
+struct lunix_inject_state_struct {
+	struct lunix_protocol_state_struct proto;
+
+	/* Serializes writes from threads sharing this open file */
+	struct mutex lock;
+
+	/* Bounce buffer for data copied in from userspace */
+	unsigned char *buf;
+};
+
+/*
+ * Function prototypes
+ */
+int lunix_inject_init(void);
+void lunix_inject_destroy(void);
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LUNIX_INJECT_H */
@@ -0,0 +1,353 @@
+/*
+ * lunix-latency-bench.c
+ *
+ * End-to-end latency benchmark for the Lunix:TNG driver: from the
+ * moment a sensor packet is handed to the TTY layer, until a reader
+ * blocked in read() on the sensor's node returns with it.
+ *
+ * Synthetic packets are written to the master side of a pty, whose
+ * slave has the Lunix line discipline attached, so they take the
+ * same path as bytes from a real base station: flush_to_ldisc(),
+ * lunix_ldisc_receive(), the protocol state machine, the sensor
+ * wakeup. With -i they are written to the injection device instead.
+ *
+ * Every packet carries a tag in its raw values, which the readers
+ * get back in binary mode [struct lunix_sample] and use to look up
+ * the time the packet was sent. A reader that falls behind only sees
+ * the latest sample of its sensor; its latency is measured from the
+ * packet that produced that sample.
+ *
+ * CPU cost per sample is taken from the system-wide counters in
+ * /proc/stat, since the receive path runs in kworker context and
+ * would not show up in our own rusage.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include "lunix.h"
+#include "lunix-chrdev.h"
+#include "lunix-inject.h"
+#include "lunix-frame.h"
+
+#define LAT_TAGS	4096	/* tags in flight per sensor, power of 2 */
+#define LAT_MAX_SENSORS	16
+
+static const char *msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+/* Send time of every tag, per sensor; 0 for tags not to be measured */
+static uint64_t sent_ns[LAT_MAX_SENSORS][LAT_TAGS];
+static volatile int stop;
+
+struct reader {
+	pthread_t thread;
+	unsigned int sensor;
+	enum lunix_msr_enum type;
+	int fd;
+
+	uint64_t *lat_ns;	/* latencies recorded */
+	size_t cnt, max;
+	unsigned long unknown;	/* samples whose tag had no send time */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* Busy and total time of all CPUs so far, in clock ticks */
+static int cpu_ticks(unsigned long long *busy, unsigned long long *total)
+{
+	FILE *fp;
+	int i, n;
+	unsigned long long v[8];
+
+	fp = fopen("/proc/stat", "r");
+	if (!fp)
+		return -errno;
+	n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	fclose(fp);
+	if (n != 8)
+		return -EINVAL;
+
+	for (*total = 0, i = 0; i < 8; i++)
+		*total += v[i];
+	*busy = *total - v[3] - v[4];	/* idle, iowait */
+	return 0;
+}
+
+static void *reader_main(void *arg)
+{
+	uint64_t t, sent;
+	struct reader *r = arg;
+	struct lunix_sample s;
+	ssize_t n;
+
+	while (!stop) {
+		n = read(r->fd, &s, sizeof(s));
+		t = now_ns();
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+		}
+		if (n != sizeof(s)) {
+			fprintf(stderr, "short read: %zd bytes\n", n);
+			break;
+		}
+
+		sent = __atomic_load_n(&sent_ns[r->sensor][s.raw & (LAT_TAGS - 1)],
+		                       __ATOMIC_ACQUIRE);
+		if (!sent || sent > t) {
+			r->unknown++;
+			continue;
+		}
+		if (r->cnt < r->max)
+			r->lat_ns[r->cnt++] = t - sent;
+	}
+
+	return NULL;
+}
+
+/*
+ * Open a pty and attach the line discipline to its slave.
+ * Returns the master, keeps the slave open in *slave.
+ */
+static int pty_setup(int *slave)
+{
+	int master, disc = N_LUNIX_LDISC;
+	struct termios tio;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	*slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror(ptsname(master));
+		return -1;
+	}
+	if (tcgetattr(*slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(*slave, TCSANOW, &tio);
+	}
+	if (ioctl(*slave, TIOCSETD, &disc) < 0) {
+		perror("set ldisc: failed to set line discipline");
+		return -1;
+	}
+
+	return master;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *v, size_t cnt, double p)
+{
+	size_t i = (size_t)(p * (cnt - 1) + 0.5);
+
+	return v[i] / 1e3;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-i] [-s sensors] [-n readers] [-c packets] [-r rate]\n\n"
+		"  -i          write packets to %s instead of a pty\n"
+		"  -s sensors  spread packets over this many sensors [default: 4, max: %d]\n"
+		"  -n readers  blocked readers, round-robin over sensors, then\n"
+		"              over measurement types [default: 8]\n"
+		"  -c packets  packets to send [default: 100000]\n"
+		"  -r rate     packets per second, 0 for as fast as possible [default: 2000]\n\n",
+		argv0, LUNIX_INJECT_PATH, LAT_MAX_SENSORS);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, out, slave = -1, inject = 0, mode = LUNIX_MODE_BINARY;
+	unsigned int i, sensors = 4, nreaders = 8;
+	unsigned long packets = 100000, rate = 2000, p;
+	uint16_t tag[LAT_MAX_SENSORS] = { 0 }, t;
+	unsigned char buf[LUNIX_FRAME_MAXLEN];
+	unsigned long long busy0, total0, busy1, total1;
+	struct rusage ru;
+	struct reader *readers;
+	uint64_t start, next, elapsed, *all;
+	unsigned long unknown = 0;
+	size_t len, cnt;
+	char path[64];
+	double sum;
+
+	while ((opt = getopt(argc, argv, "is:n:c:r:")) != -1) {
+		switch (opt) {
+		case 'i':
+			inject = 1;
+			break;
+		case 's':
+			sensors = atoi(optarg);
+			break;
+		case 'n':
+			nreaders = atoi(optarg);
+			break;
+		case 'c':
+			packets = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (sensors == 0 || sensors > LAT_MAX_SENSORS || nreaders == 0 || packets == 0)
+		usage(argv[0]);
+
+	if (inject) {
+		out = open(LUNIX_INJECT_PATH, O_WRONLY);
+		if (out < 0) {
+			perror(LUNIX_INJECT_PATH);
+			exit(1);
+		}
+	} else if ((out = pty_setup(&slave)) < 0)
+		exit(1);
+
+	readers = calloc(nreaders, sizeof(*readers));
+	if (!readers) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < nreaders; i++) {
+		struct reader *r = &readers[i];
+
+		r->sensor = i % sensors;
+		r->type = (i / sensors) % N_LUNIX_MSR;
+		r->max = packets / sensors + 1;
+		r->lat_ns = malloc(r->max * sizeof(*r->lat_ns));
+		snprintf(path, sizeof(path), "/dev/lunix%u-%s", r->sensor, msr_names[r->type]);
+		r->fd = open(path, O_RDONLY);
+		if (!r->lat_ns || r->fd < 0 || ioctl(r->fd, LUNIX_IOC_SET_MODE, &mode) < 0) {
+			perror(path);
+			exit(1);
+		}
+		if (pthread_create(&r->thread, NULL, reader_main, r)) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	/* Let the readers block before the first packet */
+	usleep(100000);
+
+	fprintf(stderr, "Sending %lu packets to %u sensors, %u readers, %s\n",
+		packets, sensors, nreaders, inject ? LUNIX_INJECT_PATH : "pty");
+	cpu_ticks(&busy0, &total0);
+	start = next = now_ns();
+	for (p = 0; p < packets; p++) {
+		i = p % sensors;
+		t = tag[i]++ & (LAT_TAGS - 1);
+		len = lunix_frame_build(buf, i + 1, t, t, t);
+		if (rate) {
+			next += 1000000000 / rate;
+			sleep_until_ns(next);
+		}
+		__atomic_store_n(&sent_ns[i][t], now_ns(), __ATOMIC_RELEASE);
+		if (write(out, buf, len) != len) {
+			perror("write");
+			exit(1);
+		}
+	}
+	elapsed = now_ns() - start;
+	cpu_ticks(&busy1, &total1);
+
+	/* Let the last samples through, then wake every reader one last time */
+	usleep(100000);
+	stop = 1;
+	for (i = 0; i < sensors; i++) {
+		t = tag[i]++ & (LAT_TAGS - 1);
+		__atomic_store_n(&sent_ns[i][t], 0, __ATOMIC_RELEASE);
+		len = lunix_frame_build(buf, i + 1, t, t, t);
+		if (write(out, buf, len) != len)
+			perror("write");
+	}
+
+	for (i = 0, cnt = 0; i < nreaders; i++) {
+		pthread_join(readers[i].thread, NULL);
+		cnt += readers[i].cnt;
+		unknown += readers[i].unknown;
+	}
+	all = malloc((cnt ? cnt : 1) * sizeof(*all));
+	if (!all) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0, cnt = 0, sum = 0; i < nreaders; i++) {
+		memcpy(all + cnt, readers[i].lat_ns, readers[i].cnt * sizeof(*all));
+		cnt += readers[i].cnt;
+		close(readers[i].fd);
+		free(readers[i].lat_ns);
+	}
+	qsort(all, cnt, sizeof(*all), cmp_u64);
+
+	printf("packets sent:     %lu in %.3f s, %.0f packets/s\n",
+		packets, elapsed / 1e9, packets / (elapsed / 1e9));
+	printf("samples read:     %zu [%.2f per packet], %lu unmatched\n",
+		cnt, (double)cnt / packets, unknown);
+	if (cnt) {
+		for (len = 0; len < cnt; len++)
+			sum += all[len];
+		printf("latency, usec:    min %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f  avg %.1f\n",
+			all[0] / 1e3, percentile_us(all, cnt, 0.5), percentile_us(all, cnt, 0.99),
+			percentile_us(all, cnt, 0.999), all[cnt - 1] / 1e3, sum / cnt / 1e3);
+	}
+	if (total1 > total0)
+		printf("system CPU:       %.1f%% busy, %.2f usec per packet\n",
+			100.0 * (busy1 - busy0) / (total1 - total0),
+			(busy1 - busy0) * 1e6 / sysconf(_SC_CLK_TCK) / packets);
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("benchmark CPU:    %.2f usec per packet [user + sys, writer and readers]\n",
+			(ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+			 ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec) / packets);
+
+	free(all);
+	free(readers);
+	if (slave >= 0)
+		close(slave);
+	close(out);
+	return 0;
+}
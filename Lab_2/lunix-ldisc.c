@@ -8,6 +8,7 @@
  */
 
 #include <linux/tty.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/serio.h>
@@ -22,24 +23,37 @@
 #include "lunix-protocol.h"
 
 /*
- * This line discipline can only be associated
- * with a single TTY at any time.
+ * Number of TTYs this line discipline may still be associated with
  */
+static int lunix_ldisc_max_ports = 16;
 static atomic_t lunix_disc_available;
 
+module_param(lunix_ldisc_max_ports, int, 0);
+MODULE_PARM_DESC(lunix_ldisc_max_ports, "Maximum number of TTYs to attach to at once");
+
 /*
  * This function runs when the userspace helper
  * sets the Lunix:TNG line discipline on a TTY.
  */
 static int lunix_ldisc_open(struct tty_struct *tty)
 {
+	struct lunix_ldisc_port_struct *port;
+
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
 	
-	/* Can only be associated with a single TTY */
+	/* Can only be associated with a limited number of TTYs */
 	if ( !atomic_add_unless(&lunix_disc_available, -1, 0))
 		return -EBUSY;
 
+	port = kzalloc(sizeof(*port), GFP_KERNEL);
+	if (!port) {
+		atomic_inc(&lunix_disc_available);
+		return -ENOMEM;
+	}
+	lunix_protocol_init(&port->proto);
+	tty->disc_data = port;
+
 	tty->receive_room = 65536; /* No flow control, FIXME */
 
 	debug("lunix ldisc associated with TTY %s\n", tty->name);
@@ -53,6 +67,8 @@ static int lunix_ldisc_open(struct tty_struct *tty)
 
 static void lunix_ldisc_close(struct tty_struct *tty)
 {
+	kfree(tty->disc_data);
+	tty->disc_data = NULL;
 	atomic_inc(&lunix_disc_available);
 	/* FIXME */
 	/* Shouldn't we wake up all sleepers in all sensors here? */
@@ -67,6 +83,7 @@ static void lunix_ldisc_close(struct tty_struct *tty)
 static void lunix_ldisc_receive(struct tty_struct *tty,
 	const unsigned char *cp, char *fp, int count)
 {
+	struct lunix_ldisc_port_struct *port = tty->disc_data;
 #if 1
 #if LUNIX_DEBUG
 	int i;
@@ -82,7 +99,7 @@ static void lunix_ldisc_receive(struct tty_struct *tty,
 	 * Pass incoming characters to protocol processing code,
 	 * which handle any necessary sensor updates.
 	 */
-	lunix_protocol_received_buf(&lunix_protocol_state, cp, count);
+	lunix_protocol_received_buf(&port->proto, cp, count);
 	//debug("passed incoming bytes to state machine, leaving\n");
 }
 
@@ -105,6 +122,44 @@ static ssize_t lunix_ldisc_write(struct tty_struct * tty, struct file * file,
 	return -EIO;
 }
 
+/*
+ * The discipline consumes everything it receives, so there is never
+ * anything to read; report hangups, so a supervising lunix-attach
+ * can notice a gateway going away and reopen its TTY.
+ */
+static __poll_t lunix_ldisc_poll(struct tty_struct *tty, struct file *file,
+	poll_table *wait)
+{
+	__poll_t mask = 0;
+
+	poll_wait(file, &tty->read_wait, wait);
+	if (tty_hung_up_p(file) || test_bit(TTY_OTHER_CLOSED, &tty->flags))
+		mask |= EPOLLHUP;
+
+	return mask;
+}
+
+static int lunix_ldisc_ioctl(struct tty_struct *tty, struct file *file,
+	unsigned int cmd, unsigned long arg)
+{
+	struct lunix_ldisc_stats stats;
+	struct lunix_ldisc_port_struct *port = tty->disc_data;
+
+	switch (cmd) {
+	case LUNIX_LDISC_IOC_STATS:
+		/* Unlocked: the counters are only ever incremented */
+		stats.bytes = port->proto.bytes;
+		stats.packets = port->proto.packets;
+		stats.dropped = port->proto.dropped;
+		if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+	default:
+		/* TCGETS, TCSETS and friends still work as usual */
+		return n_tty_ioctl_helper(tty, file, cmd, arg);
+	}
+}
+
 /*
  * The line discipline structure.
  * Initialization and release functions.
@@ -117,6 +172,8 @@ static struct tty_ldisc_ops lunix_ldisc_ops = {
 	.close =	lunix_ldisc_close,
 	.read =		lunix_ldisc_read,
 	.write =	lunix_ldisc_write,
+	.ioctl =	lunix_ldisc_ioctl,
+	.poll =		lunix_ldisc_poll,
 	.receive_buf =	lunix_ldisc_receive
 };
 
@@ -125,7 +182,7 @@ int lunix_ldisc_init(void)
 	int ret;
 
 	debug("initializing lunix ldisc\n");
-	atomic_set(&lunix_disc_available, 1);
+	atomic_set(&lunix_disc_available, lunix_ldisc_max_ports);
 	ret = tty_register_ldisc(N_LUNIX_LDISC, &lunix_ldisc_ops);
 	if (ret)
 		printk(KERN_ERR "%s: Error registering line discipline, ret = %d.\n", __FILE__, ret);
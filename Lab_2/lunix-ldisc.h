@@ -15,13 +15,43 @@
 
 #ifdef __KERNEL__ 
 
+#include "lunix-protocol.h"
+
+/*
+ * Private state for every TTY the line discipline is attached to,
+ * hanging off tty->disc_data. Each gateway gets its own protocol
+ * state machine, so several of them can feed the driver at once.
+ */
+struct lunix_ldisc_port_struct {
+	struct lunix_protocol_state_struct proto;
+};
+
 /*
  * Function prototypes
  */
 int lunix_ldisc_init(void);
 void lunix_ldisc_destroy(void);
 
+#else
+#include <stdint.h>
 #endif	/* __KERNEL__ */
 
-#endif	/* _LUNIX_H */
+#include <linux/ioctl.h>
+
+/*
+ * Per-TTY statistics, returned by LUNIX_LDISC_IOC_STATS
+ * on a TTY the discipline is attached to.
+ */
+struct lunix_ldisc_stats {
+	uint64_t bytes;		/* bytes received on this TTY */
+	uint64_t packets;	/* sensor packets applied */
+	uint64_t dropped;	/* packets dropped: unknown node, overflow */
+};
+
+/*
+ * Definition of ioctl commands
+ */
+#define LUNIX_LDISC_IOC_MAGIC		'L'
+#define LUNIX_LDISC_IOC_STATS		_IOR(LUNIX_LDISC_IOC_MAGIC, 0xE0, struct lunix_ldisc_stats)
 
+#endif	/* _LUNIX_H */
@@ -14,6 +14,8 @@
 #include "lunix.h"
 #include "lunix-chrdev.h"
 #include "lunix-ldisc.h"
+#include "lunix-inject.h"
+#include "lunix-debugfs.h"
 #include "lunix-protocol.h"
 
 /*
@@ -21,7 +23,6 @@
  */
 int lunix_sensor_cnt = LUNIX_SENSOR_CNT;
 struct lunix_sensor_struct *lunix_sensors;
-struct lunix_protocol_state_struct lunix_protocol_state;
 
 /*
  * Module init and cleanup functions
@@ -41,7 +42,6 @@ int __init lunix_module_init(void)
 		printk(KERN_ERR "Failed to allocate memory for Lunix sensors\n");
 		goto out;
 	}
-	lunix_protocol_init(&lunix_protocol_state);
 
 	/*
 	 * Initialize all sensors. On exit, si_done is the index of the last
@@ -68,12 +68,27 @@ int __init lunix_module_init(void)
 	if ((ret = lunix_chrdev_init()) < 0)
 		goto out_with_ldisc;
 
+	/*
+	 * Initialize the Lunix direct injection device
+	 */
+	if ((ret = lunix_inject_init()) < 0)
+		goto out_with_chrdev;
+
+	/*
+	 * Statistics, if debugfs is available
+	 */
+	lunix_debugfs_init();
+
 	return 0;
 
 	/*
 	 * Something's gone wrong, undo everything
 	 * we've done up to this point
 	 */
+out_with_chrdev:
+	debug("at out_with_chrdev\n");
+	lunix_chrdev_destroy();
+
 out_with_ldisc:
 	debug("at out_with_ldisc\n");
 	lunix_ldisc_destroy();
@@ -93,7 +108,9 @@ void __exit lunix_module_cleanup(void)
 {
 	int si_done;
 	
-	debug("entering, destroying chrdev and ldisc\n");
+	debug("entering, destroying statistics, injection device, chrdev and ldisc\n");
+	lunix_debugfs_destroy();
+	lunix_inject_destroy();
 	lunix_chrdev_destroy();
 	lunix_ldisc_destroy();
 	
@@ -0,0 +1,147 @@
+/*
+ * lunix-open-bench.c
+ *
+ * Measure how many open/read/close cycles per second a short-lived
+ * Lunix:TNG client can do: the cost of the per-open state allocation
+ * and locking in the character device, compared with reading an
+ * already open node and with the sysfs value attribute.
+ *
+ * The sensor must have reported at least once, so that a fresh open
+ * has data to return and read() does not block.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lunix.h"
+
+static const char *msr_names[N_LUNIX_MSR] = {
+	[BATT]	= "batt",
+	[TEMP]	= "temp",
+	[LIGHT]	= "light"
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* open, read, close, count times. Returns the seconds it took, < 0 on error */
+static double bench_cycles(const char *path, long count)
+{
+	int fd;
+	long i;
+	ssize_t n;
+	char buf[64];
+	double t0 = now_sec();
+
+	for (i = 0; i < count; i++) {
+		fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (fd < 0) {
+			perror(path);
+			return -1;
+		}
+		n = read(fd, buf, sizeof(buf));
+		if (n <= 0) {
+			fprintf(stderr, "%s: %s\n", path, n < 0 ? strerror(errno) : "no data");
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return now_sec() - t0;
+}
+
+/*
+ * count reads of a node kept open. Non-blocking: once the latest
+ * value has been returned, reads fail with EAGAIN until a new one
+ * arrives, which still goes through the locking we want to measure.
+ */
+static double bench_held(const char *path, long count)
+{
+	int fd;
+	long i;
+	ssize_t n;
+	char buf[64];
+	double t0;
+
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	t0 = now_sec();
+	for (i = 0; i < count; i++) {
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno != EAGAIN) {
+			perror(path);
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+	return now_sec() - t0;
+}
+
+static void report(const char *what, long count, double dt)
+{
+	if (dt < 0)
+		printf("%-24s failed\n", what);
+	else
+		printf("%-24s %12.0f/s %10.2f usec\n", what, count / dt, dt * 1e6 / count);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s sensor] [-t batt|temp|light] [-n cycles]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, type = TEMP;
+	long count = 200000;
+	unsigned int sensor = 0;
+	char node[64], attr[128];
+
+	while ((opt = getopt(argc, argv, "s:t:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			sensor = atoi(optarg);
+			break;
+		case 't':
+			for (type = 0; type < N_LUNIX_MSR; type++)
+				if (!strcmp(optarg, msr_names[type]))
+					break;
+			if (type == N_LUNIX_MSR)
+				usage(argv[0]);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count <= 0)
+		usage(argv[0]);
+
+	snprintf(node, sizeof(node), "/dev/lunix%u-%s", sensor, msr_names[type]);
+	snprintf(attr, sizeof(attr), "/sys/class/lunix/lunix%u-%s/value", sensor, msr_names[type]);
+
+	printf("%-24s %14s %15s\n", "", "cycles", "per cycle");
+	report("open/read/close node", count, bench_cycles(node, count));
+	report("read, node kept open", count, bench_held(node, count));
+	report("open/read/close sysfs", count, bench_cycles(attr, count));
+
+	return 0;
+}
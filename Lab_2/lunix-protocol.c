@@ -14,12 +14,35 @@
  *
  */
 
+#ifdef __KERNEL__
 #include <linux/kernel.h>
 #include <asm/byteorder.h>
+#else
+#include "lunix-user.h"
+#endif
 
 #include "lunix.h"
 #include "lunix-protocol.h"
 
+#ifdef __KERNEL__
+struct lunix_protocol_totals_struct lunix_protocol_totals;
+
+static inline void lunix_protocol_account(struct lunix_protocol_state_struct *state,
+	int length, unsigned long packets, unsigned long dropped)
+{
+	atomic_long_add(length, &lunix_protocol_totals.bytes);
+	if (state->packets != packets)
+		atomic_long_add(state->packets - packets, &lunix_protocol_totals.packets);
+	if (state->dropped != dropped)
+		atomic_long_add(state->dropped - dropped, &lunix_protocol_totals.dropped);
+}
+#else
+static inline void lunix_protocol_account(struct lunix_protocol_state_struct *state,
+	int length, unsigned long packets, unsigned long dropped)
+{
+}
+#endif
+
 /*
  * Returns an unsigned 16-bit integer in native byte-order from 
  * two bytes in an XMesh packet, which is always little-endian
@@ -74,11 +97,14 @@ static void lunix_protocol_update_sensors(struct lunix_protocol_state_struct *st
 		//debug ("I have the following raw data from nodeid = %d: { batt, temp, light } = { 0x%04x, 0x%04x, 0x%04x }\n",
 		//	nodeid, batt, temp, light);
 
-		if (nodeid > 0 && nodeid <= lunix_sensor_cnt)
+		if (nodeid > 0 && nodeid <= lunix_sensor_cnt) {
 			lunix_sensor_update(&lunix_sensors[nodeid - 1], batt, temp, light);
-		else
+			state->packets++;
+		} else {
+			state->dropped++;
 			printk(KERN_WARNING "Node id %d is out of bounds [maximum %d sensors]\n",
 				nodeid, lunix_sensor_cnt);
+		}
 	}
 }
 
@@ -113,6 +139,16 @@ static inline void set_state(struct lunix_protocol_state_struct *statep, int sta
  * Initialization of protocol state machine
  */
 void lunix_protocol_init(struct lunix_protocol_state_struct *state)
+{
+	state->bytes = state->packets = state->dropped = 0;
+	lunix_protocol_reset(state);
+}
+
+/*
+ * Back to looking for the start of a packet, e.g. for a new
+ * connection of the same input; the statistics are kept.
+ */
+void lunix_protocol_reset(struct lunix_protocol_state_struct *state)
 {
 	state->pos = 0;
 	state->next_is_special = 0;
@@ -133,12 +169,16 @@ void lunix_protocol_init(struct lunix_protocol_state_struct *state)
 static int lunix_protocol_parse_state(struct lunix_protocol_state_struct *state,
 	const unsigned char *data, int length, int *i, int use_specials)
 {
+#if LUNIX_DEBUG
 	int iter;
+#endif
 
 	//debug("entering, for *i = %d, length = %d, state = %d, btr = %d, br = %d, next_is_special = %d\n",
 	//	*i, length, state->state, state->bytes_to_read, state->bytes_read, state->next_is_special);
 
+#if LUNIX_DEBUG
 	iter = 0;
+#endif
 	while ((*i < length) && (state->bytes_read < state->bytes_to_read))
 	{
 #if LUNIX_DEBUG
@@ -153,6 +193,7 @@ static int lunix_protocol_parse_state(struct lunix_protocol_state_struct *state,
 				"packet buffer would overflow!\n", state->pos, MAX_PACKET_LEN);
 			printk(KERN_ERR "How will I ever resync with the input stream?\n");
 			state->pos = 0;
+			state->dropped++;
 			return -1;
 		}
 
@@ -213,55 +254,65 @@ int lunix_protocol_received_buf(struct lunix_protocol_state_struct *state,
 {
 	int i;
 	int payload_length;
+	unsigned long packets = state->packets, dropped = state->dropped;
 
 	i = 0;
+	state->bytes += length;
+
+	/*
+	 * A single buffer may carry several packets, e.g. when it comes
+	 * from a batched write to the injection device, so keep going
+	 * until every byte has been consumed.
+	 */
+	while (i < length) {
+		if (state->state == SEEKING_START_BYTE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
+				set_state(state, SEEKING_PACKET_TYPE, 1, 0);
+
+
+		if (state->state == SEEKING_PACKET_TYPE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
+				set_state(state, SEEKING_DESTINATION_ADDRESS, 2, 0);
+
+		if (state->state == SEEKING_DESTINATION_ADDRESS) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_AM_TYPE, 1, 0);
+
+		if (state->state == SEEKING_AM_TYPE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_AM_GROUP, 1, 0);
+
+		if (state->state == SEEKING_AM_GROUP) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_PAYLOAD_LENGTH, 1, 0);
+
+		if (state->state == SEEKING_PAYLOAD_LENGTH) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1) {
+				payload_length = state->packet[state->pos - 1];
+				set_state(state, SEEKING_PAYLOAD, payload_length, 0);
+			}
 
-	if (state->state == SEEKING_START_BYTE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
-			set_state(state, SEEKING_PACKET_TYPE, 1, 0);
-
-
-	if (state->state == SEEKING_PACKET_TYPE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
-			set_state(state, SEEKING_DESTINATION_ADDRESS, 2, 0);
-
-	if (state->state == SEEKING_DESTINATION_ADDRESS) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_AM_TYPE, 1, 0);
-
-	if (state->state == SEEKING_AM_TYPE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_AM_GROUP, 1, 0);
-
-	if (state->state == SEEKING_AM_GROUP) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_PAYLOAD_LENGTH, 1, 0);
-
-	if (state->state == SEEKING_PAYLOAD_LENGTH) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1) {
-			payload_length = state->packet[state->pos - 1];
-			set_state(state, SEEKING_PAYLOAD, payload_length, 0);
-		}
-
-	if (state->state == SEEKING_PAYLOAD) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_CRC, 2, 0);
+		if (state->state == SEEKING_PAYLOAD) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_CRC, 2, 0);
 
-	if (state->state == SEEKING_CRC) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_END_BYTE, 1, 0);
+		if (state->state == SEEKING_CRC) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_END_BYTE, 1, 0);
 
-	if (state->state == SEEKING_END_BYTE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1) {
-			//debug("An XMesh packet has been received, updating sensors\n");
+		if (state->state == SEEKING_END_BYTE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1) {
+				//debug("An XMesh packet has been received, updating sensors\n");
 
-			lunix_protocol_update_sensors(state, lunix_sensors);
-			state->pos = 0;
-			state->next_is_special = 0;
-			set_state(state, SEEKING_START_BYTE, 1, 0);
-		}
+				lunix_protocol_update_sensors(state, lunix_sensors);
+				state->pos = 0;
+				state->next_is_special = 0;
+				set_state(state, SEEKING_START_BYTE, 1, 0);
+			}
+	}
 
 	//debug("leaving\n");
 
+	lunix_protocol_account(state, length, packets, dropped);
 	return 0;
 }
@@ -13,7 +13,7 @@
 #ifndef _LUNIX_PROTOCOL_H
 #define _LUNIX_PROTOCOL_H
 
-#ifdef __KERNEL__ 
+#if defined(__KERNEL__) || defined(LUNIX_USERSPACE)
 
 /*
  * Application/Protocol specific constants
@@ -51,15 +51,36 @@ struct lunix_protocol_state_struct
 	unsigned char next_is_special;  /* The next character to be received is a special character */
 	unsigned char payload_length;   /* The length of the payload of the received packet */
 	unsigned char packet[MAX_PACKET_LEN]; /* The XMesh packet being received */
+
+	/* Statistics, for whoever owns this state machine */
+	unsigned long bytes;            /* Bytes fed to the state machine */
+	unsigned long packets;          /* Sensor packets applied to a sensor */
+	unsigned long dropped;          /* Packets for unknown nodes, overflows */
+};
+
+#ifdef __KERNEL__
+/*
+ * The same counters, summed over every state machine in the module:
+ * all TTYs the line discipline is attached to and all open files of
+ * the injection device. Exported through debugfs.
+ */
+struct lunix_protocol_totals_struct {
+	atomic_long_t bytes;
+	atomic_long_t packets;
+	atomic_long_t dropped;
 };
 
+extern struct lunix_protocol_totals_struct lunix_protocol_totals;
+#endif
+
 /*
  * Function prototypes
  */
 void lunix_protocol_init(struct lunix_protocol_state_struct *);
+void lunix_protocol_reset(struct lunix_protocol_state_struct *);
 int lunix_protocol_received_buf(struct lunix_protocol_state_struct *, const unsigned char *buf, int count);
 
-#endif	/* __KERNEL__ */
+#endif	/* __KERNEL__ || LUNIX_USERSPACE */
 
 #endif	/* _LUNIX_H */
 
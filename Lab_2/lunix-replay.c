@@ -0,0 +1,178 @@
+/*
+ * lunix-replay.c
+ *
+ * Replay a raw sensor stream recorded by lunix-attach -w
+ * into the Lunix:TNG driver, either as fast as possible or
+ * following the original receive timing, optionally sped up.
+ *
+ * The output is the injection device by default, but any
+ * file can be given, e.g. the master side of a pty with the
+ * Lunix line discipline attached to its slave.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lunix-inject.h"
+#include "lunix-capture.h"
+
+#define REPLAY_BATCH	(64 * 1024)	/* coalesce records up to this size when not timed */
+
+static int insist_write(int fd, const unsigned char *buf, size_t cnt)
+{
+	ssize_t ret;
+
+	while (cnt > 0) {
+		ret = write(fd, buf, cnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		cnt -= ret;
+	}
+
+	return 0;
+}
+
+/* Sleep until the given CLOCK_MONOTONIC time, in microseconds */
+static void sleep_until(uint64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-f | -x factor] [-l loops] capture_file [output]\n\n"
+		"Replay a capture into output [default: %s].\n\n"
+		"  -f         as fast as possible, ignoring the recorded timing\n"
+		"  -x factor  follow the recorded timing, sped up by factor [default: 1]\n"
+		"  -l loops   replay the capture this many times [default: 1]\n\n",
+		argv0, LUNIX_INJECT_PATH);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fd, fast, loops, loop, first, ret;
+	double factor, secs;
+	ssize_t len;
+	size_t pending;
+	uint64_t usec, first_usec, start, target, late, max_late;
+	unsigned long long bytes, records;
+	struct lunix_capture cap;
+	const char *in_path, *out_path;
+	static unsigned char buf[LUNIX_CAPTURE_MAXREC + REPLAY_BATCH];
+
+	fast = 0;
+	factor = 1.0;
+	loops = 1;
+	while ((opt = getopt(argc, argv, "fx:l:")) != -1) {
+		switch (opt) {
+		case 'f':
+			fast = 1;
+			break;
+		case 'x':
+			factor = atof(optarg);
+			if (factor <= 0)
+				usage(argv[0]);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			if (loops <= 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 && optind != argc - 2)
+		usage(argv[0]);
+	in_path = argv[optind];
+	out_path = (optind == argc - 2) ? argv[optind + 1] : LUNIX_INJECT_PATH;
+
+	if ((fd = open(out_path, O_WRONLY)) < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", out_path, strerror(errno));
+		return 1;
+	}
+
+	bytes = records = 0;
+	max_late = 0;
+	ret = 0;
+	start = lunix_capture_now();
+
+	for (loop = 0; loop < loops && !ret; loop++) {
+		if ((ret = lunix_capture_open(&cap, in_path)) < 0) {
+			fprintf(stderr, "cannot open capture %s: %s\n", in_path, strerror(-ret));
+			return 1;
+		}
+
+		/*
+		 * In fast mode, records are appended to buf and written
+		 * out in large batches; in timed mode every record is
+		 * written as soon as its (scaled) receive time comes.
+		 */
+		pending = 0;
+		first = 1;
+		first_usec = 0;
+		target = lunix_capture_now();
+		while ((len = lunix_capture_read(&cap, &usec, buf + pending,
+		                                 LUNIX_CAPTURE_MAXREC)) > 0) {
+			if (first) {
+				first_usec = usec;
+				first = 0;
+			}
+			records++;
+			bytes += len;
+			if (fast) {
+				pending += len;
+				if (pending < REPLAY_BATCH)
+					continue;
+			} else {
+				usec = target + (uint64_t)((usec - first_usec) / factor);
+				sleep_until(usec);
+				late = lunix_capture_now() - usec;
+				if (late > max_late)
+					max_late = late;
+				pending = len;
+			}
+			if ((ret = insist_write(fd, buf, pending)) < 0)
+				break;
+			pending = 0;
+		}
+		if (!ret && len < 0) {
+			fprintf(stderr, "capture %s is corrupt: %s\n", in_path, strerror(-len));
+			ret = len;
+		} else {
+			if (!ret && pending)
+				ret = insist_write(fd, buf, pending);
+			if (ret < 0)
+				fprintf(stderr, "write to %s failed: %s\n", out_path, strerror(-ret));
+		}
+		lunix_capture_close(&cap);
+	}
+	close(fd);
+
+	secs = (lunix_capture_now() - start) / 1e6;
+	fprintf(stderr, "replayed %llu records, %llu bytes in %.3f s: %.2f MB/s, %.0f records/s",
+		records, bytes, secs, secs > 0 ? bytes / 1e6 / secs : 0.0,
+		secs > 0 ? records / secs : 0.0);
+	if (!fast)
+		fprintf(stderr, ", max lateness %.3f ms", max_late / 1e3);
+	fprintf(stderr, "\n");
+
+	return ret < 0;
+}
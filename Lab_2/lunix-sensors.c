@@ -20,10 +20,36 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/mmzone.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
 #include <linux/vmalloc.h>
 #include <linux/spinlock.h>
 
 #include "lunix.h"
+#include "lunix-chrdev.h"
+
+/*
+ * Wakeup coalescing window, in microseconds. 0 wakes readers on every
+ * packet; otherwise a burst of packets for the same sensor arriving
+ * within the window costs readers a single wakeup.
+ */
+static unsigned int lunix_coalesce_us;
+module_param(lunix_coalesce_us, uint, 0644);
+MODULE_PARM_DESC(lunix_coalesce_us, "Coalesce reader wakeups within this many usec [0: off]");
+
+static enum hrtimer_restart lunix_sensor_wake_timer(struct hrtimer *timer)
+{
+	struct lunix_sensor_struct *s = container_of(timer, struct lunix_sensor_struct, wake_timer);
+
+	/* Updates from now on arm a new window */
+	clear_bit(0, &s->wake_pending);
+	smp_mb__after_atomic();
+
+	atomic_long_inc(&s->wakeups);
+	wake_up_interruptible(&s->wq);
+
+	return HRTIMER_NORESTART;
+}
 
 /*
  * Initialization and destruction of sensor structures
@@ -39,6 +65,16 @@ int lunix_sensor_init(struct lunix_sensor_struct *s)
 	 */
 	spin_lock_init(&s->lock);
 	init_waitqueue_head(&s->wq);
+	hrtimer_init(&s->wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->wake_timer.function = lunix_sensor_wake_timer;
+	s->wake_pending = 0;
+	s->flags = 0;
+	memset(&s->iat, 0, sizeof(s->iat));
+	atomic_long_set(&s->updates, 0);
+	atomic_long_set(&s->wakeups, 0);
+	atomic_long_set(&s->wakeups_saved, 0);
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		atomic_set(&s->readers[i], 0);
 
 	/*
 	 * Allocate one page per measurement buffer
@@ -56,6 +92,10 @@ int lunix_sensor_init(struct lunix_sensor_struct *s)
 		s->msr_data[i]->magic = LUNIX_MSR_MAGIC;
 	}
 
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		if ((ret = lunix_history_init(&s->hist[i])) < 0)
+			goto out;
+
 	ret = 0;
 out:
 	return ret;
@@ -65,32 +105,110 @@ void lunix_sensor_destroy(struct lunix_sensor_struct *s)
 {
 	int i;
 
+	hrtimer_cancel(&s->wake_timer);
+
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		lunix_history_destroy(&s->hist[i]);
+
 	for (i = 0; i < N_LUNIX_MSR; i++) {
 		if (s->msr_data[i])
 			free_page((unsigned long)s->msr_data[i]);
 	}
 }
 
+/*
+ * Account for a packet arriving at now_ns: a few integer
+ * operations per packet, and one 64-bit division to get
+ * the gap in usec.
+ */
+static void lunix_iat_update(struct lunix_iat_struct *iat, uint64_t now_ns)
+{
+	uint32_t gap_us;
+	int64_t d;
+
+	if (iat->last_ns) {
+		gap_us = min_t(uint64_t, div_u64(now_ns - iat->last_ns, NSEC_PER_USEC), U32_MAX);
+		iat->hist[min(fls(gap_us), LUNIX_IAT_BUCKETS - 1)]++;
+
+		/* J += (|D| - J) / 16, kept scaled by 16 */
+		if (iat->gaps++) {
+			d = (int64_t)gap_us - iat->gap_us;
+			iat->jitter16 += abs(d) - ((iat->jitter16 + 8) >> 4);
+		}
+		iat->gap_us = gap_us;
+	}
+	iat->last_ns = now_ns;
+}
+
+/*
+ * Update one measurement page. The sequence number is odd while
+ * the page is inconsistent, for the sake of readers that have it
+ * mapped and cannot take the spinlock.
+ */
+static void lunix_msr_update(struct lunix_msr_data_struct *msr,
+	enum lunix_msr_enum type, uint16_t raw, uint32_t now)
+{
+	uint32_t seq = msr->values[LUNIX_MSR_SEQ];
+
+	WRITE_ONCE(msr->values[LUNIX_MSR_SEQ], seq + 1);
+	smp_wmb();
+
+	msr->values[LUNIX_MSR_RAW] = raw;
+	msr->values[LUNIX_MSR_VALUE] = (int32_t)lunix_msr_convert(type, raw);
+	msr->magic = LUNIX_MSR_MAGIC;
+	msr->last_update = now;
+
+	smp_wmb();
+	WRITE_ONCE(msr->values[LUNIX_MSR_SEQ], seq + 2);
+}
+
 void lunix_sensor_update(struct lunix_sensor_struct *s,
 	uint16_t batt, uint16_t temp, uint16_t light)
 {
+	uint32_t now = get_seconds();
+	uint64_t now_ms = ktime_to_ms(ktime_get_real());
+	unsigned int coalesce_us = READ_ONCE(lunix_coalesce_us);
+
 	spin_lock(&s->lock);
 	
 	/*
 	 * Update the raw values and the relevant timestamps.
 	 */
-	s->msr_data[BATT]->values[0] = batt;
-	s->msr_data[TEMP]->values[0] = temp;
-	s->msr_data[LIGHT]->values[0] = light;
+	s->last_ms = now_ms;
+	lunix_iat_update(&s->iat, ktime_get_ns());
+	lunix_msr_update(s->msr_data[BATT], BATT, batt, now);
+	lunix_msr_update(s->msr_data[TEMP], TEMP, temp, now);
+	lunix_msr_update(s->msr_data[LIGHT], LIGHT, light, now);
 
-	s->msr_data[BATT]->magic = s->msr_data[TEMP]->magic = s->msr_data[LIGHT]->magic = LUNIX_MSR_MAGIC;
-	s->msr_data[BATT]->last_update = s->msr_data[TEMP]->last_update = s->msr_data[LIGHT]->last_update = get_seconds();
+	lunix_history_append(&s->hist[BATT], now_ms, batt,
+		s->msr_data[BATT]->values[LUNIX_MSR_VALUE]);
+	lunix_history_append(&s->hist[TEMP], now_ms, temp,
+		s->msr_data[TEMP]->values[LUNIX_MSR_VALUE]);
+	lunix_history_append(&s->hist[LIGHT], now_ms, light,
+		s->msr_data[LIGHT]->values[LUNIX_MSR_VALUE]);
 	
 	spin_unlock(&s->lock);
+	atomic_long_inc(&s->updates);
+
+	/* First sign of life: have its device nodes created */
+	if (!test_bit(LUNIX_SENSOR_SEEN, &s->flags) &&
+	    !test_and_set_bit(LUNIX_SENSOR_SEEN, &s->flags))
+		lunix_chrdev_sensor_appeared(s - lunix_sensors);
 
 	/*
 	 * And wake up any sleepers who may be waiting on
-	 * fresh data from this sensor.
+	 * fresh data from this sensor, now or when the
+	 * coalescing window closes.
 	 */
-	wake_up_interruptible(&s->wq);
+	if (!coalesce_us) {
+		atomic_long_inc(&s->wakeups);
+		wake_up_interruptible(&s->wq);
+		return;
+	}
+	if (test_and_set_bit(0, &s->wake_pending)) {
+		atomic_long_inc(&s->wakeups_saved);
+		return;
+	}
+	hrtimer_start(&s->wake_timer, ns_to_ktime((u64)coalesce_us * NSEC_PER_USEC),
+		HRTIMER_MODE_REL);
 }
@@ -0,0 +1,104 @@
+/*
+ * lunix-shm.h
+ *
+ * Layout of the POSIX shared memory segment in which lunixd,
+ * the userspace Lunix:TNG daemon, publishes sensor data.
+ *
+ * The segment is a header page followed by one page per sensor and
+ * measurement, sensor-major: page 1 + sensor * N_LUNIX_MSR + type.
+ * Every measurement page is a struct lunix_msr_data_struct, just like
+ * the ones the kernel driver keeps, with values[] laid out as:
+ *
+ *   values[LUNIX_SHM_RAW]      raw 16-bit measurement
+ *   values[LUNIX_SHM_VALUE]    converted value, in thousandths [int32_t]
+ *   values[LUNIX_SHM_SEQ]      update sequence number, odd while updating
+ *   values[LUNIX_SHM_COUNT]    number of samples ever written to history
+ *   values[LUNIX_SHM_HIST...]  history ring: { timestamp, raw, value } triplets,
+ *                              sample n lives in slot n % LUNIX_SHM_HISTORY
+ *
+ * The sequence numbers double as futex words: lunixd wakes every waiter
+ * on a page's sequence number, and on the header's, after each update.
+ *
+ */
+
+#ifndef _LUNIX_SHM_H
+#define _LUNIX_SHM_H
+
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "lunix.h"
+
+#define LUNIX_SHM_NAME		"/lunix"
+#define LUNIX_SHM_MAGIC		0x4C4E5853	/* "LNXS" */
+#define LUNIX_SHM_VERSION	1
+#define LUNIX_SHM_PAGE		4096
+
+#define LUNIX_SHM_RAW		LUNIX_MSR_RAW
+#define LUNIX_SHM_VALUE		LUNIX_MSR_VALUE
+#define LUNIX_SHM_SEQ		LUNIX_MSR_SEQ
+#define LUNIX_SHM_COUNT		3
+#define LUNIX_SHM_HIST		4
+#define LUNIX_SHM_HISTORY	256	/* samples kept per measurement */
+
+struct lunix_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sensor_cnt;
+	uint32_t history;	/* LUNIX_SHM_HISTORY */
+	uint32_t seq;		/* bumped after every update of any sensor */
+	uint32_t pid;		/* of the publishing daemon */
+};
+
+static inline size_t lunix_shm_size(unsigned int sensor_cnt)
+{
+	return (size_t)LUNIX_SHM_PAGE * (1 + sensor_cnt * N_LUNIX_MSR);
+}
+
+static inline struct lunix_msr_data_struct *
+lunix_shm_msr(void *base, unsigned int sensor, enum lunix_msr_enum type)
+{
+	return (struct lunix_msr_data_struct *)((char *)base +
+		LUNIX_SHM_PAGE * (1 + sensor * N_LUNIX_MSR + type));
+}
+
+/*
+ * Take a consistent snapshot of the latest sample of a measurement.
+ * Returns its sequence number, which is 0 if nothing has arrived yet.
+ */
+static inline uint32_t lunix_shm_read(const struct lunix_msr_data_struct *msr,
+	uint32_t *raw, int32_t *value, uint32_t *last_update)
+{
+	uint32_t seq;
+
+	do {
+		while ((seq = __atomic_load_n(&msr->values[LUNIX_SHM_SEQ],
+		                              __ATOMIC_ACQUIRE)) & 1)
+			;
+		*raw = msr->values[LUNIX_SHM_RAW];
+		*value = (int32_t)msr->values[LUNIX_SHM_VALUE];
+		*last_update = msr->last_update;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&msr->values[LUNIX_SHM_SEQ], __ATOMIC_RELAXED));
+
+	return seq / 2;
+}
+
+/*
+ * Sleep until the futex word stops being equal to seen, or until
+ * timeout [NULL for none]. seen is a raw sequence word, as loaded.
+ */
+static inline int lunix_shm_wait(const uint32_t *word, uint32_t seen,
+	const struct timespec *timeout)
+{
+	if (syscall(SYS_futex, word, FUTEX_WAIT, seen, timeout, NULL, 0) < 0 &&
+	    errno != EAGAIN)
+		return -errno;
+	return 0;
+}
+
+#endif	/* _LUNIX_SHM_H */
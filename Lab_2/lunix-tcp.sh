@@ -8,6 +8,10 @@ Usage: $0 pts_port
 
 Connect to the TCP endpoint $TCP_ENDPOINT
 and forward all incoming data to pts_port.
+
+To skip socat and the pty altogether, run
+	./lunix-attach -T $TCP_ENDPOINT
+instead, which feeds the driver through /dev/lunix-inject.
 EOF
 	exit 1
 fi
@@ -0,0 +1,266 @@
+/*
+ * lunix-top.c
+ *
+ * Live dashboard of Lunix:TNG driver statistics: per sensor, the
+ * update and wakeup rates, the timing of its packets, the readers of
+ * each node and the state of its history; for the protocol parser,
+ * its byte, packet and drop rates over all TTYs and the injection
+ * device.
+ *
+ * Everything comes from the counters the driver exports in debugfs
+ * [see lunix-debugfs.c], read once per interval: no LUNIX_DEBUG
+ * build and no cost to the driver beyond formatting a few lines.
+ * Files are parsed by their header line, so new columns do not
+ * break older versions of this tool.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lunix.h"
+#include "lunix-debugfs.h"
+
+#define TOP_MAX_COLS	48
+#define TOP_MAX_ROWS	(256 * N_LUNIX_MSR)
+
+/* A debugfs statistics file: named columns, rows of numbers */
+struct top_table {
+	int ncols, nrows;
+	char names[TOP_MAX_COLS][32];
+	unsigned long long v[TOP_MAX_ROWS][TOP_MAX_COLS];
+};
+
+/* Everything read in one pass */
+struct top_sample {
+	double t;
+	struct top_table sensors, history, protocol, arrivals;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int table_read(const char *path, struct top_table *tab)
+{
+	FILE *fp;
+	char line[1024], *tok, *save;
+	int col;
+
+	tab->ncols = tab->nrows = 0;
+	if (!(fp = fopen(path, "r")))
+		return -errno;
+
+	if (fgets(line, sizeof(line), fp))
+		for (tok = strtok_r(line, " \n", &save); tok && tab->ncols < TOP_MAX_COLS;
+		     tok = strtok_r(NULL, " \n", &save))
+			snprintf(tab->names[tab->ncols++], sizeof(tab->names[0]), "%s", tok);
+
+	while (tab->nrows < TOP_MAX_ROWS && fgets(line, sizeof(line), fp)) {
+		col = 0;
+		for (tok = strtok_r(line, " \n", &save); tok && col < tab->ncols;
+		     tok = strtok_r(NULL, " \n", &save))
+			tab->v[tab->nrows][col++] = strtoull(tok, NULL, 10);
+		if (col == tab->ncols)
+			tab->nrows++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* Index of a column, -1 if this driver does not export it */
+static int table_col(const struct top_table *tab, const char *name)
+{
+	int i;
+
+	for (i = 0; i < tab->ncols; i++)
+		if (!strcmp(tab->names[i], name))
+			return i;
+	return -1;
+}
+
+static unsigned long long table_get(const struct top_table *tab, int row, const char *name)
+{
+	int col = table_col(tab, name);
+
+	return (col < 0 || row >= tab->nrows) ? 0 : tab->v[row][col];
+}
+
+/* Row of a sensor, -1 if there is none */
+static int table_row(const struct top_table *tab, int sensor)
+{
+	int r, cs = table_col(tab, "sensor");
+
+	for (r = 0; cs >= 0 && r < tab->nrows; r++)
+		if (tab->v[r][cs] == sensor)
+			return r;
+	return -1;
+}
+
+static double rate(unsigned long long now, unsigned long long then, double dt)
+{
+	return now >= then ? (now - then) / dt : 0;
+}
+
+/* Sum of a history column over the measurements of a sensor */
+static unsigned long long history_sum(const struct top_table *h, int sensor, const char *name)
+{
+	int r, cs = table_col(h, "sensor");
+	unsigned long long sum = 0;
+
+	for (r = 0; r < h->nrows; r++)
+		if (cs >= 0 && h->v[r][cs] == sensor)
+			sum += table_get(h, r, name);
+	return sum;
+}
+
+static void show(const struct top_sample *cur, const struct top_sample *prev, int all, int clear)
+{
+	int r, a, sensor;
+	double dt = cur->t - prev->t;
+	time_t wall = time(NULL);
+	const struct top_table *s = &cur->sensors, *ps = &prev->sensors;
+	const struct top_table *p = &cur->protocol, *pp = &prev->protocol;
+	unsigned long long last, hdrop, phdrop;
+
+	if (clear)
+		printf("\033[H\033[2J");
+	printf("Lunix:TNG  %.24s  interval %.1f s\n\n", ctime(&wall), dt);
+
+	if (p->nrows)
+		printf("parser: %10.0f bytes/s %8.1f packets/s %8.1f dropped/s   "
+			"[total %llu packets, %llu dropped]\n\n",
+			rate(table_get(p, 0, "bytes"), table_get(pp, 0, "bytes"), dt),
+			rate(table_get(p, 0, "packets"), table_get(pp, 0, "packets"), dt),
+			rate(table_get(p, 0, "dropped"), table_get(pp, 0, "dropped"), dt),
+			table_get(p, 0, "packets"), table_get(p, 0, "dropped"));
+	else
+		printf("parser: no statistics [%s]\n\n", LUNIX_DEBUGFS_PROTOCOL);
+
+	printf("%6s %9s %9s %9s %7s %9s %9s %17s %10s %9s %9s\n", "sensor", "upd/s", "wake/s",
+		"saved/s", "age", "gap ms", "jitter ms", "readers b/t/l", "history", "hdrop/s",
+		"hist KiB");
+	for (r = 0; r < s->nrows; r++) {
+		sensor = table_get(s, r, "sensor");
+		last = table_get(s, r, "last_update");
+		if (!all && !last && !table_get(s, r, "readers_batt") &&
+		    !table_get(s, r, "readers_temp") && !table_get(s, r, "readers_light"))
+			continue;
+
+		hdrop = history_sum(&cur->history, sensor, "dropped");
+		phdrop = history_sum(&prev->history, sensor, "dropped");
+		printf("%6d %9.1f %9.1f %9.1f ", sensor,
+			rate(table_get(s, r, "updates"), table_get(ps, r, "updates"), dt),
+			rate(table_get(s, r, "wakeups"), table_get(ps, r, "wakeups"), dt),
+			rate(table_get(s, r, "saved"), table_get(ps, r, "saved"), dt));
+		if (last)
+			printf("%6llds ", (long long)(wall - (time_t)last));
+		else
+			printf("%7s ", "-");
+		a = table_row(&cur->arrivals, sensor);
+		if (a >= 0 && table_get(&cur->arrivals, a, "gaps") > 1)
+			printf("%9.1f %9.1f ", table_get(&cur->arrivals, a, "gap_us") / 1e3,
+				table_get(&cur->arrivals, a, "jitter_us") / 1e3);
+		else
+			printf("%9s %9s ", "-", "-");
+		printf("%7llu/%llu/%-7llu %10llu %9.1f %9.1f\n",
+			table_get(s, r, "readers_batt"), table_get(s, r, "readers_temp"),
+			table_get(s, r, "readers_light"),
+			history_sum(&cur->history, sensor, "samples"),
+			rate(hdrop, phdrop, dt),
+			history_sum(&cur->history, sensor, "bytes") / 1024.0);
+	}
+	fflush(stdout);
+}
+
+static int sample(struct top_sample *smp)
+{
+	int ret;
+
+	smp->t = now_sec();
+	if ((ret = table_read(LUNIX_DEBUGFS_SENSORS, &smp->sensors)) < 0) {
+		fprintf(stderr, "%s: %s\n", LUNIX_DEBUGFS_SENSORS, strerror(-ret));
+		return ret;
+	}
+	/* Older drivers may lack these; show what there is */
+	table_read(LUNIX_DEBUGFS_HISTORY, &smp->history);
+	table_read(LUNIX_DEBUGFS_PROTOCOL, &smp->protocol);
+	table_read(LUNIX_DEBUGFS_ARRIVALS, &smp->arrivals);
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-a] [-b] [-d seconds] [-n count]\n\n"
+		"  -a          show every sensor, not only those that reported or are open\n"
+		"  -b          batch mode: do not clear the screen between updates\n"
+		"  -d seconds  update interval [default: 1]\n"
+		"  -n count    exit after count updates\n\n"
+		"Needs debugfs mounted and readable [%s].\n",
+		argv0, LUNIX_DEBUGFS_SENSORS);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, all = 0, batch = 0;
+	long count = -1;
+	double interval = 1.0;
+	struct top_sample *cur, *prev, *tmp;
+
+	while ((opt = getopt(argc, argv, "abd:n:")) != -1) {
+		switch (opt) {
+		case 'a':
+			all = 1;
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'd':
+			interval = atof(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (interval <= 0 || count == 0)
+		usage(argv[0]);
+
+	cur = malloc(sizeof(*cur));
+	prev = malloc(sizeof(*prev));
+	if (!cur || !prev) {
+		perror("malloc");
+		exit(1);
+	}
+	if (sample(prev) < 0)
+		exit(1);
+
+	while (count < 0 || count-- > 0) {
+		usleep(interval * 1e6);
+		if (sample(cur) < 0)
+			exit(1);
+		show(cur, prev, all, !batch && isatty(STDOUT_FILENO));
+		if (batch)
+			putchar('\n');
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	free(cur);
+	free(prev);
+	return 0;
+}
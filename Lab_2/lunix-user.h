@@ -0,0 +1,40 @@
+/*
+ * lunix-user.h
+ *
+ * The handful of kernel facilities lunix-protocol.c relies on,
+ * so that it can be built unchanged into userspace programs
+ * [with -DLUNIX_USERSPACE].
+ *
+ */
+
+#ifndef _LUNIX_USER_H
+#define _LUNIX_USER_H
+
+#ifndef __KERNEL__
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <inttypes.h>
+
+#ifndef LUNIX_DEBUG
+#define LUNIX_DEBUG		0
+#endif
+
+#define KERN_ERR		""
+#define KERN_WARNING		""
+#define KERN_INFO		""
+#define KERN_DEBUG		""
+
+#define printk(fmt, arg...)	fprintf(stderr, fmt, ##arg)
+#define le16_to_cpu(x)		le16toh(x)
+
+#if LUNIX_DEBUG
+#define debug(fmt, arg...)	fprintf(stderr, "%s: " fmt, __func__ , ##arg)
+#else
+#define debug(fmt, arg...)	do { } while(0)
+#endif
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LUNIX_USER_H */
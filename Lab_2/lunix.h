@@ -13,21 +13,41 @@
 /* Compile-time parameters */
 #define LUNIX_VERSION_STRING	"0.1701-D"
 
+#define LUNIX_MSR_MAGIC 0xF00DF00D
+
+enum lunix_msr_enum { BATT = 0, TEMP, LIGHT, N_LUNIX_MSR };
+
 #ifdef __KERNEL__ 
 
 #include <linux/fs.h>
 #include <linux/tty.h>
+#include <linux/atomic.h>
+#include <linux/hrtimer.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 
+#include "lunix-history.h"
+
+/*
+ * Inter-arrival statistics of a sensor's packets. Bucket k of the
+ * histogram counts gaps of [2^(k-1), 2^k) usec, bucket 0 gaps under
+ * a usec, the last bucket everything longer. Jitter is the smoothed
+ * mean deviation between consecutive gaps, as in RFC 3550.
+ */
+#define LUNIX_IAT_BUCKETS	32
+
+struct lunix_iat_struct {
+	uint64_t last_ns;	/* arrival of the latest packet, monotonic; 0: none yet */
+	unsigned long gaps;	/* gaps measured */
+	uint32_t gap_us;	/* the latest gap */
+	uint64_t jitter16;	/* jitter in usec, times 16 */
+	uint32_t hist[LUNIX_IAT_BUCKETS];
+};
+
 /*
  * A structure representing a hardware sensor
  * and pages holding the most recent measurements received
  */
-
-#define LUNIX_MSR_MAGIC 0xF00DF00D
-
-enum lunix_msr_enum { BATT = 0, TEMP, LIGHT, N_LUNIX_MSR };
 struct lunix_sensor_struct {
 	/*
 	 * A number of pages, one for each measurement.
@@ -46,15 +66,43 @@ struct lunix_sensor_struct {
 	 * when this sensor has been updated with new data
 	 */
 	wait_queue_head_t wq;
+
+	/* LUNIX_SENSOR_* flag bits */
+	unsigned long flags;
+
+	/* Time of the last update, msec since the Epoch, under the spinlock */
+	uint64_t last_ms;
+
+	/* Packet inter-arrival times and jitter, under the spinlock */
+	struct lunix_iat_struct iat;
+
+	/*
+	 * Wakeup coalescing [lunix_coalesce_us]: the first update
+	 * of a burst arms the timer, the readers are woken once
+	 * when it expires and find the newest data.
+	 */
+	struct hrtimer wake_timer;
+	unsigned long wake_pending;	/* bit 0: wake_timer armed */
+
+	/* Statistics, see lunix-debugfs.c */
+	atomic_long_t updates;		/* packets received for this sensor */
+	atomic_long_t wakeups;		/* times the wait queue was woken */
+	atomic_long_t wakeups_saved;	/* updates folded into a pending wakeup */
+	atomic_t readers[N_LUNIX_MSR];	/* open files, per measurement */
+
+	/* Compressed long-term history, under the spinlock */
+	struct lunix_history_struct hist[N_LUNIX_MSR];
 };
 
+/* Bits of lunix_sensor_struct.flags */
+#define LUNIX_SENSOR_SEEN	0	/* has reported at least once, nodes exist */
+
 /*
  * The default value for the maximum number of sensors supported
  */
 #define LUNIX_SENSOR_CNT			16
 extern int lunix_sensor_cnt;
 extern struct lunix_sensor_struct *lunix_sensors;
-extern struct lunix_protocol_state_struct lunix_protocol_state;
 
 /*
  * Debugging
@@ -73,9 +121,27 @@ int lunix_sensor_init(struct lunix_sensor_struct *);
 void lunix_sensor_destroy(struct lunix_sensor_struct *);
 void lunix_sensor_update(struct lunix_sensor_struct *s,
 	uint16_t batt, uint16_t temp, uint16_t light);
+long lunix_msr_convert(enum lunix_msr_enum type, uint16_t raw);
 
 #else
 #include <inttypes.h>
+
+#ifdef LUNIX_USERSPACE
+/*
+ * lunix-protocol.c can also be built into a userspace daemon [lunixd],
+ * which provides the sensors the protocol state machine updates.
+ * There, a sensor is just its measurement pages, in shared memory.
+ */
+struct lunix_sensor_struct {
+	struct lunix_msr_data_struct *msr_data[N_LUNIX_MSR];
+};
+
+extern int lunix_sensor_cnt;
+extern struct lunix_sensor_struct *lunix_sensors;
+
+void lunix_sensor_update(struct lunix_sensor_struct *s,
+	uint16_t batt, uint16_t temp, uint16_t light);
+#endif	/* LUNIX_USERSPACE */
 #endif	/* __KERNEL__ */
 /*
  * A structure, living at the start of a page, containing a version number
@@ -88,6 +154,15 @@ struct lunix_msr_data_struct {
 	uint32_t values[];
 };
 
+/*
+ * Meaning of the first values[] of a measurement page. The sequence
+ * number is odd while the page is being updated; readers of a mapped
+ * page retry if it was odd, or changed, while they were looking.
+ */
+#define LUNIX_MSR_RAW		0	/* raw 16-bit measurement */
+#define LUNIX_MSR_VALUE		1	/* converted value, in thousandths [int32_t] */
+#define LUNIX_MSR_SEQ		2	/* update sequence number */
+
 /*
  * Lunix:TNG line discipline number:
  * Hijack the "Mobitex module" line discipline, since the number
@@ -4,9 +4,23 @@
 
 mknod /dev/ttyS0 c 4 64
 
-# Lunix:TNG nodes: 16 sensors, each has 3 nodes.
+# Lunix:TNG nodes. With udev they appear by themselves as soon as
+# each sensor reports; without it, create them for 16 sensors, each
+# has 3 nodes. The major number is dynamic, minors are packed:
+# sensor * 3 + measurement.
+major=$(awk '$2 == "lunix" { print $1 }' /proc/devices)
+if [ -z "$major" ]; then
+	echo "$0: the lunix module is not loaded" >&2
+	exit 1
+fi
 for sensor in $(seq 0 1 15); do
-	mknod /dev/lunix$sensor-batt c 60 $[$sensor * 8 + 0]
-	mknod /dev/lunix$sensor-temp c 60 $[$sensor * 8 + 1]
-	mknod /dev/lunix$sensor-light c 60 $[$sensor * 8 + 2]
+	[ -e /dev/lunix$sensor-batt ] || mknod /dev/lunix$sensor-batt c $major $[$sensor * 3 + 0]
+	[ -e /dev/lunix$sensor-temp ] || mknod /dev/lunix$sensor-temp c $major $[$sensor * 3 + 1]
+	[ -e /dev/lunix$sensor-light ] || mknod /dev/lunix$sensor-light c $major $[$sensor * 3 + 2]
 done
+
+# Lunix:TNG direct injection node, registered with a dynamic misc minor.
+if [ -r /sys/class/misc/lunix-inject/dev ]; then
+	IFS=: read major minor </sys/class/misc/lunix-inject/dev
+	mknod -m 0200 /dev/lunix-inject c $major $minor
+fi
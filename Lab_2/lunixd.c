@@ -0,0 +1,329 @@
+/*
+ * lunixd.c
+ *
+ * Userspace Lunix:TNG daemon, for hosts that cannot load the
+ * kernel module.
+ *
+ * Reads the raw XMesh stream from a TTY or a TCP endpoint, runs it
+ * through the very same protocol state machine as the driver
+ * [lunix-protocol.c] and publishes every sensor's measurements, with
+ * a short history, in a POSIX shared memory segment. See lunix-shm.h
+ * for its layout. Clients map the segment and sleep on futexes,
+ * no system call is needed to fetch a sample.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "lunix.h"
+#include "lunix-shm.h"
+#include "lunix-protocol.h"
+#include "lunix-lookup.h"
+
+#define LUNIXD_BUFSZ		(64 * 1024)
+#define LUNIXD_BACKOFF_MAX_MS	30000
+
+/*
+ * Global state, the protocol state machine calls back into it
+ */
+int lunix_sensor_cnt = 16;
+struct lunix_sensor_struct *lunix_sensors;
+
+static struct lunix_shm_header *shm_hdr;
+static volatile sig_atomic_t stop;
+
+static long *lookup[N_LUNIX_MSR] = {
+	[BATT]	= lookup_voltage,
+	[TEMP]	= lookup_temperature,
+	[LIGHT]	= lookup_light
+};
+
+static void futex_wake_all(uint32_t *word)
+{
+	(void) syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Called by the protocol state machine for every sensor packet.
+ * Each measurement page is updated under its sequence number,
+ * readers retry if it changed while they were looking.
+ */
+void lunix_sensor_update(struct lunix_sensor_struct *s,
+	uint16_t batt, uint16_t temp, uint16_t light)
+{
+	int i;
+	uint32_t seq, slot, now;
+	uint16_t raw[N_LUNIX_MSR] = { [BATT] = batt, [TEMP] = temp, [LIGHT] = light };
+	struct lunix_msr_data_struct *msr;
+
+	now = time(NULL);
+	for (i = 0; i < N_LUNIX_MSR; i++) {
+		msr = s->msr_data[i];
+		seq = msr->values[LUNIX_SHM_SEQ];
+		__atomic_store_n(&msr->values[LUNIX_SHM_SEQ], seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		msr->last_update = now;
+		msr->values[LUNIX_SHM_RAW] = raw[i];
+		msr->values[LUNIX_SHM_VALUE] = (int32_t)lookup[i][raw[i]];
+		slot = LUNIX_SHM_HIST + 3 * (msr->values[LUNIX_SHM_COUNT] % LUNIX_SHM_HISTORY);
+		msr->values[slot] = now;
+		msr->values[slot + 1] = raw[i];
+		msr->values[slot + 2] = msr->values[LUNIX_SHM_VALUE];
+		msr->values[LUNIX_SHM_COUNT]++;
+
+		__atomic_store_n(&msr->values[LUNIX_SHM_SEQ], seq + 2, __ATOMIC_RELEASE);
+		futex_wake_all(&msr->values[LUNIX_SHM_SEQ]);
+	}
+	__atomic_add_fetch(&shm_hdr->seq, 1, __ATOMIC_RELEASE);
+	futex_wake_all(&shm_hdr->seq);
+}
+
+/* Create the shared segment and point every sensor at its pages. */
+static int shm_setup(const char *name)
+{
+	int fd, i, t;
+	size_t size;
+	void *base;
+
+	size = lunix_shm_size(lunix_sensor_cnt);
+	if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) < 0) {
+		fprintf(stderr, "shm_open(%s): %s\n", name, strerror(errno));
+		return -1;
+	}
+	/* Start from scratch, a previous instance may have left data behind */
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0) {
+		fprintf(stderr, "ftruncate(%s): %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	if (!(lunix_sensors = calloc(lunix_sensor_cnt, sizeof(*lunix_sensors)))) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		for (t = 0; t < N_LUNIX_MSR; t++) {
+			lunix_sensors[i].msr_data[t] = lunix_shm_msr(base, i, t);
+			lunix_sensors[i].msr_data[t]->magic = LUNIX_MSR_MAGIC;
+		}
+
+	shm_hdr = base;
+	shm_hdr->sensor_cnt = lunix_sensor_cnt;
+	shm_hdr->history = LUNIX_SHM_HISTORY;
+	shm_hdr->version = LUNIX_SHM_VERSION;
+	shm_hdr->pid = getpid();
+	/* Publish the magic last, clients check it before anything else */
+	__atomic_store_n(&shm_hdr->magic, LUNIX_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static speed_t find_speed(const char *speed)
+{
+	static const struct { const char *name; speed_t code; } speeds[] = {
+		{ "9600", B9600 }, { "19200", B19200 }, { "38400", B38400 },
+		{ "57600", B57600 }, { "115200", B115200 }, { "230400", B230400 },
+		{ "460800", B460800 }, { "921600", B921600 }, { NULL, 0 }
+	};
+	int i;
+
+	for (i = 0; speeds[i].name; i++)
+		if (!strcmp(speeds[i].name, speed))
+			return speeds[i].code;
+	return B0;
+}
+
+/* Open a serial line in raw 8N1 mode. */
+static int open_tty(const char *path, speed_t speed)
+{
+	int fd;
+	struct termios tio;
+
+	if ((fd = open(path, O_RDONLY | O_NOCTTY)) < 0) {
+		fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) < 0) {
+		fprintf(stderr, "tcgetattr(%s): %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetspeed(&tio, speed);
+	if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+		fprintf(stderr, "tcsetattr(%s): %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Connect to host:port, retrying with backoff until it works or we are told to stop. */
+static int open_tcp(const char *endpoint)
+{
+	int fd, ret;
+	unsigned int backoff = 100;
+	char host[256];
+	const char *colon;
+	struct addrinfo hints, *res, *ai;
+
+	if (!(colon = strrchr(endpoint, ':')) || colon == endpoint ||
+	    colon - endpoint >= sizeof(host)) {
+		fprintf(stderr, "endpoint must be of the form host:port\n");
+		return -1;
+	}
+	memcpy(host, endpoint, colon - endpoint);
+	host[colon - endpoint] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	while (!stop) {
+		fd = -1;
+		if ((ret = getaddrinfo(host, colon + 1, &hints, &res)) == 0) {
+			for (ai = res; ai; ai = ai->ai_next) {
+				if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+					continue;
+				if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+					break;
+				close(fd);
+				fd = -1;
+			}
+			freeaddrinfo(res);
+		}
+		if (fd >= 0) {
+			fprintf(stderr, "connected to %s\n", endpoint);
+			return fd;
+		}
+		fprintf(stderr, "cannot connect to %s, retrying in %u ms\n", endpoint, backoff);
+		usleep(backoff * 1000);
+		backoff = backoff * 2 > LUNIXD_BACKOFF_MAX_MS ? LUNIXD_BACKOFF_MAX_MS : backoff * 2;
+	}
+	return -1;
+}
+
+static void sig_catch(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-n sensors] [-N shm_name] [-s speed] tty_line\n"
+		"       %s [-n sensors] [-N shm_name] -T host:port\n\n"
+		"Publish Lunix:TNG sensor data in shared memory, without the kernel module.\n\n"
+		"  -n sensors   number of sensors [default: %d]\n"
+		"  -N shm_name  name of the shared memory segment [default: %s]\n"
+		"  -s speed     line speed of tty_line [default: 57600]\n"
+		"  -T host:port read from a TCP endpoint instead, reconnecting as needed\n\n",
+		argv0, argv0, lunix_sensor_cnt, LUNIX_SHM_NAME);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fd;
+	ssize_t cnt;
+	speed_t speed = B57600;
+	struct sigaction sa;
+	const char *shm_name = LUNIX_SHM_NAME;
+	const char *endpoint = NULL;
+	struct lunix_protocol_state_struct state;
+	static unsigned char buf[LUNIXD_BUFSZ];
+
+	while ((opt = getopt(argc, argv, "n:N:s:T:")) != -1) {
+		switch (opt) {
+		case 'n':
+			lunix_sensor_cnt = atoi(optarg);
+			if (lunix_sensor_cnt <= 0)
+				usage(argv[0]);
+			break;
+		case 'N':
+			shm_name = optarg;
+			break;
+		case 's':
+			if ((speed = find_speed(optarg)) == B0)
+				usage(argv[0]);
+			break;
+		case 'T':
+			endpoint = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (endpoint ? optind != argc : optind != argc - 1)
+		usage(argv[0]);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_catch;
+	sigemptyset(&sa.sa_mask);
+	(void) sigaction(SIGHUP, &sa, NULL);
+	(void) sigaction(SIGINT, &sa, NULL);
+	(void) sigaction(SIGQUIT, &sa, NULL);
+	(void) sigaction(SIGTERM, &sa, NULL);
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	if (shm_setup(shm_name) < 0)
+		return 1;
+	fprintf(stderr, "Publishing %d sensors in shared memory segment %s\n",
+		lunix_sensor_cnt, shm_name);
+
+	/* Counters add up over all connections */
+	lunix_protocol_init(&state);
+	while (!stop) {
+		fd = endpoint ? open_tcp(endpoint) : open_tty(argv[optind], speed);
+		if (fd < 0)
+			break;
+
+		/* Every connection starts from a clean state machine */
+		lunix_protocol_reset(&state);
+		while (!stop) {
+			cnt = read(fd, buf, sizeof(buf));
+			if (cnt < 0 && errno == EINTR)
+				continue;
+			if (cnt <= 0) {
+				fprintf(stderr, "input closed: %s\n",
+					cnt < 0 ? strerror(errno) : "end of file");
+				break;
+			}
+			lunix_protocol_received_buf(&state, buf, cnt);
+		}
+		close(fd);
+
+		/* A TTY that goes away is not coming back */
+		if (!endpoint)
+			break;
+	}
+
+	shm_unlink(shm_name);
+	fprintf(stderr, "%lu bytes, %lu packets, %lu dropped\n",
+		state.bytes, state.packets, state.dropped);
+	return 0;
+}
@@ -5,6 +5,11 @@
  * lookup tables for converting 16-bit raw measurements
  * from the wireless sensors to actual floating point values.
  *
+ * Without arguments, emits lunix-lookup.h, the tables of the driver.
+ * With -u, emits lunix-convert-tables.h, the same values as int32_t
+ * tables for the userspace conversion library [lunix-convert.c]:
+ * half the cache footprint, and the element size of a SIMD gather.
+ *
  * Ioannis Panagopoulos <ioannis@cslab.ece.ntua.gr>
  * Vangelis Koukis <vkoukis@cslab.ece.ntua.gr>
  *
@@ -12,6 +17,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
 /*
@@ -66,10 +72,59 @@ long uint16_to_temp(uint16_t value)
 	return (l < -272150) ?  -272150 : l;
 }
 
-int main(void)
+/*
+ * The tables of lunix-convert-tables.h, indexed by enum lunix_msr_enum.
+ * Fails if a value does not fit in an int32_t.
+ */
+static int emit_convert_tables(void)
+{
+	unsigned int i, t;
+	long v;
+	static const char *names[] = { "batt", "temp", "light" };
+	static long (*const conv[])(uint16_t) = { uint16_to_batt, uint16_to_temp, uint16_to_light };
+
+	fprintf(stdout,
+		"/*\n"
+		" * lunix-convert-tables.h\n"
+		" *\n"
+		" * Machine-generated file. DO NOT EDIT.\n"
+		" * See %s instead.\n"
+		" *\n"
+		" * The lookup tables of lunix-lookup.h, as int32_t,\n"
+		" * for the userspace conversion library.\n"
+		" */\n"
+		"\n", __FILE__);
+
+	for (t = 0; t < 3; t++) {
+		fprintf(stdout, "static const int32_t lunix_convert_%s[65536] "
+			"__attribute__((aligned(64))) = {\n", names[t]);
+		for (i = 0; i <= 0xFFFF; i++) {
+			v = conv[t](i);
+			if (v < INT32_MIN || v > INT32_MAX) {
+				fprintf(stderr, "%s: %s[%u] = %ld does not fit in 32 bits\n",
+					__FILE__, names[t], i, v);
+				return 1;
+			}
+			fprintf(stdout, "%s%ld%s", (i % 4) ? " " : "\t", v,
+				(i == 0xFFFF) ? "\n" : (i % 4 == 3) ? ",\n" : ",");
+		}
+		fprintf(stdout, "};\n\n");
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
 {
 	unsigned int i;
 
+	if (argc == 2 && !strcmp(argv[1], "-u"))
+		return emit_convert_tables();
+	if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-u]\n", argv[0]);
+		return 1;
+	}
+
 	fprintf(stdout,
 		"/*\n"
 		" * lunix-tables.h\n"
@@ -0,0 +1,288 @@
+/*
+ * chat-epoll.c
+ *
+ * The epoll backend of socket-server [chat-server.h]
+ *
+ * Every worker waits on its own epoll instance, for its listening
+ * socket, its eventfd, the console on worker 0, and its clients.
+ * What a client sends is read straight into its frame buffer. Write
+ * queues are written out with writev(), and EPOLLOUT is only watched
+ * for while the socket is too full to take the rest.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "chat-server.h"
+
+#define CHAT_MAX_EVENTS	256		/* epoll events handled per wakeup */
+
+/* epoll_event.data.ptr for the fds that are not connections */
+static char chat_tag_listen, chat_tag_stdin, chat_tag_inbox;
+
+static void chat_watch(struct chat_conn *c, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return;
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(c->w->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+		perror("epoll_ctl: modify client");
+	c->events = events;
+}
+
+static void chat_epoll_close(struct chat_conn *c)
+{
+	close(c->fd);	/* also removes it from the epoll set */
+	c->fd = -1;
+	c->next = c->w->dead;
+	c->w->dead = c;
+}
+
+/*
+ * Write as many queued messages as the socket takes, CHAT_IOV_MAX
+ * per writev(). Returns -1 if the connection is gone, and has been
+ * closed.
+ */
+static int chat_conn_flush(struct chat_conn *c)
+{
+	struct iovec iov[CHAT_IOV_MAX];
+	size_t want;
+	ssize_t ret;
+	int i, n;
+
+	while (c->wq.count > 0) {
+		n = chat_wq_iov(&c->wq, 0, iov, CHAT_IOV_MAX);
+		for (want = 0, i = 0; i < n; i++)
+			want += iov[i].iov_len;
+
+		ret = writev(c->fd, iov, n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			chat_conn_close(c, strerror(errno));
+			return -1;
+		}
+		chat_wq_consume(&c->wq, ret);
+
+		/* A short write means the socket is full */
+		if (ret < want)
+			break;
+	}
+
+	/* Only ask for EPOLLOUT while there is something left to write */
+	c->blocked = c->wq.count > 0;
+	chat_watch(c, EPOLLIN | (c->blocked ? EPOLLOUT : 0));
+	return 0;
+}
+
+static void chat_epoll_flush(struct chat_conn *c)
+{
+	chat_conn_flush(c);
+}
+
+/*
+ * Read as much as the socket has, straight into the frame buffer,
+ * and handle every message completed by it where it lies.
+ */
+static void chat_conn_readable(struct chat_conn *c)
+{
+	char *p;
+	size_t space;
+	ssize_t n;
+
+	for (;;) {
+		if (!(space = chat_frame_rx_space(&c->rx, &p))) {
+			chat_conn_close(c, "out of memory");
+			return;
+		}
+		n = read(c->fd, p, space);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				chat_conn_close(c, strerror(errno));
+			return;
+		}
+		if (n == 0) {
+			chat_conn_close(c, NULL);
+			return;
+		}
+
+		chat_frame_rx_commit(&c->rx, n);
+		if (chat_conn_parse(c) < 0)
+			return;
+
+		/* A short read drained the socket; don't spend a syscall finding out */
+		if (n < space)
+			return;
+	}
+}
+
+/* Accept every pending connection */
+static void chat_accept(struct chat_worker *w)
+{
+	int fd;
+	struct epoll_event ev;
+	struct chat_conn *c;
+
+	for (;;) {
+		fd = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN)
+				perror("accept");
+			return;
+		}
+
+		if (!(c = chat_conn_new(w, fd))) {
+			perror("calloc");
+			close(fd);
+			continue;
+		}
+		c->events = EPOLLIN;
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("epoll_ctl: add client");
+			chat_conn_free(c);
+			continue;
+		}
+		chat_conn_start(c);
+	}
+}
+
+static void chat_stdin_readable(struct chat_worker *w)
+{
+	static char buf[CHAT_CONSOLE_MAX];
+	struct epoll_event ev;
+	ssize_t n;
+
+	n = read(0, buf, sizeof(buf));
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		perror("Something went wrong with the read!\n");
+		exit(1);
+	}
+	if (n == 0)
+		epoll_ctl(w->epfd, EPOLL_CTL_DEL, 0, &ev);
+	chat_console_input(w, buf, n);
+}
+
+static int chat_epoll_init(struct chat_worker *w)
+{
+	struct epoll_event ev;
+
+	/* One epoll set for the listening socket, the inbox and the clients */
+	if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &chat_tag_listen;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listen_fd, &ev) < 0) {
+		perror("epoll_ctl: listening socket");
+		goto out;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &chat_tag_inbox;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->efd, &ev) < 0) {
+		perror("epoll_ctl: eventfd");
+		goto out;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &chat_tag_stdin;
+	if (w->console && epoll_ctl(w->epfd, EPOLL_CTL_ADD, 0, &ev) < 0)
+		perror("epoll_ctl: console, not reading stdin");
+	return 0;
+
+out:
+	close(w->epfd);
+	w->epfd = -1;
+	return -1;
+}
+
+static void chat_epoll_fini(struct chat_worker *w)
+{
+	close(w->epfd);
+	w->epfd = -1;
+}
+
+static void *chat_epoll_run(void *arg)
+{
+	int i, n;
+	uint64_t cnt;
+	struct chat_worker *w = arg;
+	struct epoll_event events[CHAT_MAX_EVENTS];
+
+	for (;;) {
+		n = epoll_wait(w->epfd, events, CHAT_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		for (i = 0; i < n; i++) {
+			void *p = events[i].data.ptr;
+			struct chat_conn *c = p;
+
+			if (p == &chat_tag_listen) {
+				chat_accept(w);
+				continue;
+			}
+			if (p == &chat_tag_inbox) {
+				if (read(w->efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+					perror("read: eventfd");
+				chat_inbox_drain(w);
+				continue;
+			}
+			if (p == &chat_tag_stdin) {
+				chat_stdin_readable(w);
+				continue;
+			}
+
+			if (c->closed)
+				continue;	/* closed earlier in this batch */
+			if ((events[i].events & (EPOLLERR | EPOLLHUP)) &&
+			    !(events[i].events & EPOLLIN)) {
+				chat_conn_close(c, "connection error");
+				continue;
+			}
+			if (events[i].events & EPOLLOUT)
+				if (chat_conn_flush(c) < 0)
+					continue;
+			if (events[i].events & EPOLLIN)
+				chat_conn_readable(c);
+		}
+		chat_flush_all(w);
+		chat_reap(w);
+	}
+
+	/* This will never happen */
+	return NULL;
+}
+
+const struct chat_backend chat_epoll_backend = {
+	.name	= "epoll",
+	.init	= chat_epoll_init,
+	.fini	= chat_epoll_fini,
+	.run	= chat_epoll_run,
+	.flush	= chat_epoll_flush,
+	.close	= chat_epoll_close,
+};
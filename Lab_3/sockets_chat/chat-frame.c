@@ -0,0 +1,113 @@
+/*
+ * chat-frame.c
+ *
+ * Message framing for the chat protocol; see chat-frame.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat-frame.h"
+
+int chat_varint_encode(void *p, uint64_t v)
+{
+	unsigned char *b = p;
+	int n = 0;
+
+	while (v >= 0x80) {
+		b[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b[n++] = v;
+	return n;
+}
+
+int chat_varint_decode(const void *p, size_t avail, uint64_t *v)
+{
+	const unsigned char *b = p;
+	uint64_t val = 0;
+	size_t i;
+
+	for (i = 0; i < avail && i < CHAT_FRAME_HDR_MAX; i++) {
+		val |= (uint64_t)(b[i] & 0x7f) << (7 * i);
+		if (!(b[i] & 0x80)) {
+			*v = val;
+			return i + 1;
+		}
+	}
+	return i == CHAT_FRAME_HDR_MAX ? -1 : 0;
+}
+
+void chat_frame_rx_init(struct chat_frame_rx *rx, size_t max)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->max = max;
+}
+
+size_t chat_frame_rx_space(struct chat_frame_rx *rx, char **p)
+{
+	size_t want, len = rx->tail - rx->head;
+	char *buf;
+
+	/* Nothing pending: back to a small buffer, if a big frame grew it */
+	if (len == 0) {
+		rx->head = rx->tail = 0;
+		if (rx->cap > CHAT_FRAME_RX_INIT) {
+			free(rx->buf);
+			rx->buf = NULL;
+			rx->cap = 0;
+		}
+	}
+
+	want = rx->need > CHAT_FRAME_RX_INIT ? rx->need : CHAT_FRAME_RX_INIT;
+	if (rx->head + want > rx->cap || rx->tail == rx->cap) {
+		/* Move the incomplete frame to the front, grow if still short */
+		if (rx->head > 0) {
+			memmove(rx->buf, rx->buf + rx->head, len);
+			rx->head = 0;
+			rx->tail = len;
+		}
+		if (want > rx->cap) {
+			if (!(buf = realloc(rx->buf, want)))
+				return 0;
+			rx->buf = buf;
+			rx->cap = want;
+		}
+	}
+
+	*p = rx->buf + rx->tail;
+	return rx->cap - rx->tail;
+}
+
+int chat_frame_next(struct chat_frame_rx *rx, char **payload, size_t *len)
+{
+	uint64_t plen;
+	int hdr;
+
+	hdr = chat_varint_decode(rx->buf + rx->head, rx->tail - rx->head, &plen);
+	if (hdr < 0)
+		return -1;
+	if (hdr == 0) {
+		rx->need = 0;
+		return 0;
+	}
+	if (plen > rx->max)
+		return -1;
+
+	if (rx->tail - rx->head < hdr + plen) {
+		rx->need = hdr + plen;
+		return 0;
+	}
+	*payload = rx->buf + rx->head + hdr;
+	*len = plen;
+	rx->head += hdr + plen;
+	rx->need = 0;
+	return 1;
+}
+
+void chat_frame_rx_destroy(struct chat_frame_rx *rx)
+{
+	free(rx->buf);
+	chat_frame_rx_init(rx, rx->max);
+}
@@ -0,0 +1,87 @@
+/*
+ * chat-frame.h
+ *
+ * Message framing for the chat protocol
+ *
+ * Every message on the wire is a frame: its length as a varint,
+ * seven bits per byte, least significant first, the top bit set on
+ * all bytes but the last; then that many bytes of payload.
+ *
+ * The receiving side reads into a chat_frame_rx and takes complete
+ * frames out of it as pointers into its buffer, so payloads are not
+ * copied. The buffer grows to fit the largest frame in flight, up to
+ * CHAT_FRAME_MAX, and only the bytes of an incomplete frame are ever
+ * moved, to make room behind them.
+ *
+ */
+
+#ifndef _CHAT_FRAME_H
+#define _CHAT_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHAT_FRAME_MAX		(1 << 20)	/* largest payload on the wire */
+#define CHAT_FRAME_HDR_MAX	10		/* bytes of varint for a uint64_t */
+#define CHAT_FRAME_RX_INIT	4096		/* receive buffer, before it grows */
+
+/* Store v at p; returns the number of bytes used */
+int chat_varint_encode(void *p, uint64_t v);
+
+/*
+ * Decode a varint from the avail bytes at p: returns the number of
+ * bytes it took, 0 if they are not all there yet, -1 if it is longer
+ * than CHAT_FRAME_HDR_MAX.
+ */
+int chat_varint_decode(const void *p, size_t avail, uint64_t *v);
+
+/* Bytes taken by the header of a frame of len bytes */
+static inline int chat_frame_hdr_len(size_t len)
+{
+	int n = 1;
+
+	while (len >= 0x80) {
+		len >>= 7;
+		n++;
+	}
+	return n;
+}
+
+/* Bytes received, [head, tail) of buf not handed out yet */
+struct chat_frame_rx {
+	char *buf;
+	size_t cap, head, tail;
+	size_t need;			/* size of the incomplete frame at head */
+	size_t max;			/* largest payload accepted */
+};
+
+/*
+ * max is at most CHAT_FRAME_MAX; less for a receiver that relays
+ * payloads with something prepended to them.
+ */
+void chat_frame_rx_init(struct chat_frame_rx *rx, size_t max);
+
+/*
+ * Where to read() into next: returns how many bytes fit at *p, after
+ * making room for the whole of the frame being received if needed;
+ * 0 on ENOMEM.
+ */
+size_t chat_frame_rx_space(struct chat_frame_rx *rx, char **p);
+
+/* n bytes were read into the space */
+static inline void chat_frame_rx_commit(struct chat_frame_rx *rx, size_t n)
+{
+	rx->tail += n;
+}
+
+/*
+ * Take the next complete frame: returns 1 and points *payload to its
+ * len bytes, valid until the next chat_frame_rx_space(); 0 if there
+ * is no complete frame yet; -1 if the peer sent a bad header or a
+ * frame larger than the receiver accepts.
+ */
+int chat_frame_next(struct chat_frame_rx *rx, char **payload, size_t *len);
+
+void chat_frame_rx_destroy(struct chat_frame_rx *rx);
+
+#endif	/* _CHAT_FRAME_H */
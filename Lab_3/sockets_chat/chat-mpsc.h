@@ -0,0 +1,75 @@
+/*
+ * chat-mpsc.h
+ *
+ * A lock-free multi-producer, single-consumer queue
+ *
+ * Intrusive, after Dmitry Vyukov's node-based MPSC queue: any
+ * thread can push with one atomic exchange, and never waits; only
+ * the owner of the queue pops. A pop racing with a push that has
+ * swapped the head but not linked its node yet comes back empty,
+ * so producers must wake the consumer after pushing, not before.
+ *
+ */
+
+#ifndef _CHAT_MPSC_H
+#define _CHAT_MPSC_H
+
+#include <stddef.h>
+
+struct chat_mpsc_node {
+	struct chat_mpsc_node *next;
+};
+
+struct chat_mpsc {
+	struct chat_mpsc_node *head;	/* last pushed, shared by producers */
+	struct chat_mpsc_node *tail;	/* next to pop, the consumer's own */
+	struct chat_mpsc_node stub;
+};
+
+static inline void chat_mpsc_init(struct chat_mpsc *q)
+{
+	q->stub.next = NULL;
+	q->head = q->tail = &q->stub;
+}
+
+static inline void chat_mpsc_push(struct chat_mpsc *q, struct chat_mpsc_node *n)
+{
+	struct chat_mpsc_node *prev;
+
+	__atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&q->head, n, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/* The oldest node, or NULL if there is none ready; consumer only */
+static inline struct chat_mpsc_node *chat_mpsc_pop(struct chat_mpsc *q)
+{
+	struct chat_mpsc_node *tail = q->tail;
+	struct chat_mpsc_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &q->stub) {
+		if (!next)
+			return NULL;
+		q->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	/* tail looks like the last node; unless a push is halfway through */
+	if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	/* Put the stub behind it, so that tail can be handed out */
+	chat_mpsc_push(q, &q->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+#endif	/* _CHAT_MPSC_H */
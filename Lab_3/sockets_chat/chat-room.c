@@ -0,0 +1,162 @@
+/*
+ * chat-room.c
+ *
+ * Chat rooms, reference-counted messages and bounded
+ * write queues; see chat-room.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat-room.h"
+
+/* The rooms of the calling thread */
+static __thread struct chat_room *chat_rooms;
+
+struct chat_msg *chat_msg_new(size_t len)
+{
+	struct chat_msg *m = malloc(sizeof(*m) + len);
+
+	if (!m)
+		return NULL;
+	m->refs = 1;
+	m->len = len;
+	return m;
+}
+
+void chat_msg_put(struct chat_msg *m)
+{
+	if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(m);
+}
+
+void chat_wq_init(struct chat_wq *wq, unsigned int cap)
+{
+	memset(wq, 0, sizeof(*wq));
+	wq->cap = cap;
+}
+
+int chat_wq_push(struct chat_wq *wq, struct chat_msg *m)
+{
+	if (wq->count == wq->cap)
+		return -1;
+	if (!wq->ring && !(wq->ring = malloc(wq->cap * sizeof(*wq->ring))))
+		return -1;
+
+	wq->ring[(wq->head + wq->count++) % wq->cap] = chat_msg_get(m);
+	return 0;
+}
+
+int chat_wq_iov(const struct chat_wq *wq, unsigned int first, struct iovec *iov, int max)
+{
+	int i;
+	unsigned int k;
+	struct chat_msg *m;
+	size_t off;
+
+	for (i = 0, k = first; i < max && k < wq->count; i++, k++) {
+		m = wq->ring[(wq->head + k) % wq->cap];
+		off = k ? 0 : wq->off;
+		iov[i].iov_base = m->data + off;
+		iov[i].iov_len = m->len - off;
+	}
+	return i;
+}
+
+void chat_wq_consume(struct chat_wq *wq, size_t bytes)
+{
+	struct chat_msg *m;
+
+	while (bytes > 0 && wq->count > 0) {
+		m = wq->ring[wq->head];
+		if (bytes < m->len - wq->off) {
+			wq->off += bytes;
+			return;
+		}
+		bytes -= m->len - wq->off;
+		wq->off = 0;
+		wq->head = (wq->head + 1) % wq->cap;
+		wq->count--;
+		chat_msg_put(m);
+	}
+}
+
+void chat_wq_destroy(struct chat_wq *wq)
+{
+	while (wq->count > 0) {
+		chat_msg_put(wq->ring[wq->head]);
+		wq->head = (wq->head + 1) % wq->cap;
+		wq->count--;
+	}
+	free(wq->ring);
+	wq->ring = NULL;
+	wq->off = 0;
+}
+
+struct chat_room *chat_room_find(const char *name)
+{
+	struct chat_room *r;
+
+	for (r = chat_rooms; r; r = r->next)
+		if (!strncmp(r->name, name, sizeof(r->name) - 1))
+			return r;
+	return NULL;
+}
+
+struct chat_room *chat_room_lookup(const char *name)
+{
+	struct chat_room *r;
+
+	if ((r = chat_room_find(name)))
+		return r;
+	if (!(r = calloc(1, sizeof(*r))))
+		return NULL;
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->next = chat_rooms;
+	if (chat_rooms)
+		chat_rooms->prev = r;
+	chat_rooms = r;
+	return r;
+}
+
+void chat_room_leave(struct chat_member *m)
+{
+	struct chat_room *r = m->room;
+
+	if (!r)
+		return;
+	if (m->prev)
+		m->prev->next = m->next;
+	else
+		r->members = m->next;
+	if (m->next)
+		m->next->prev = m->prev;
+	m->room = NULL;
+	m->prev = m->next = NULL;
+
+	if (--r->nmembers == 0) {
+		if (r->prev)
+			r->prev->next = r->next;
+		else
+			chat_rooms = r->next;
+		if (r->next)
+			r->next->prev = r->prev;
+		free(r);
+	}
+}
+
+void chat_room_join(struct chat_room *r, struct chat_member *m)
+{
+	if (m->room == r)
+		return;
+	chat_room_leave(m);
+
+	m->room = r;
+	m->prev = NULL;
+	m->next = r->members;
+	if (r->members)
+		r->members->prev = m;
+	r->members = m;
+	r->nmembers++;
+}
@@ -0,0 +1,98 @@
+/*
+ * chat-room.h
+ *
+ * Chat rooms, and the messages fanned out to their members
+ *
+ * A message is stored once, in a reference-counted buffer, and
+ * queued by pointer on the write queue of every recipient; the last
+ * one to write it out frees it. Write queues are bounded, so that a
+ * slow reader costs the server a fixed amount of memory at most.
+ *
+ * Messages may be shared between threads, so their reference counts
+ * are atomic. Rooms are not: every thread has its own set of them,
+ * and a room with members on several threads exists on each.
+ *
+ */
+
+#ifndef _CHAT_ROOM_H
+#define _CHAT_ROOM_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define CHAT_ROOM_NAME_MAX	32
+#define CHAT_ROOM_DEFAULT	"lobby"
+
+struct chat_msg {
+	unsigned int refs;
+	size_t len;
+	char data[];
+};
+
+/* A new message of len bytes, with a single reference; NULL on ENOMEM */
+struct chat_msg *chat_msg_new(size_t len);
+
+static inline struct chat_msg *chat_msg_get(struct chat_msg *m)
+{
+	__atomic_fetch_add(&m->refs, 1, __ATOMIC_RELAXED);
+	return m;
+}
+
+void chat_msg_put(struct chat_msg *m);
+
+/*
+ * The messages waiting to be written to one socket: a ring of at
+ * most cap pointers, of which the first has off bytes written.
+ */
+struct chat_wq {
+	struct chat_msg **ring;
+	unsigned int head, count, cap;
+	size_t off;
+};
+
+/* cap is the queue limit; the ring is allocated on first use */
+void chat_wq_init(struct chat_wq *wq, unsigned int cap);
+
+/* Queue a reference to m; -1 if the queue is full, or on ENOMEM */
+int chat_wq_push(struct chat_wq *wq, struct chat_msg *m);
+
+/*
+ * Describe up to max queued messages, from the first-th on, for
+ * writev(); returns how many.
+ */
+int chat_wq_iov(const struct chat_wq *wq, unsigned int first, struct iovec *iov, int max);
+
+/* bytes were written: drop the messages that are done */
+void chat_wq_consume(struct chat_wq *wq, size_t bytes);
+
+/* Drop everything, free the ring */
+void chat_wq_destroy(struct chat_wq *wq);
+
+struct chat_room;
+
+/* Embedded in every connection that can be in a room */
+struct chat_member {
+	struct chat_room *room;		/* NULL: in no room */
+	struct chat_member *prev, *next;
+};
+
+struct chat_room {
+	char name[CHAT_ROOM_NAME_MAX];
+	unsigned int nmembers;
+	struct chat_member *members;
+	struct chat_room *prev, *next;	/* all rooms */
+};
+
+/* The room called name, NULL if there is none */
+struct chat_room *chat_room_find(const char *name);
+
+/* The room called name, created if needed; NULL on ENOMEM */
+struct chat_room *chat_room_lookup(const char *name);
+
+/* Move m to room r, out of the room it was in */
+void chat_room_join(struct chat_room *r, struct chat_member *m);
+
+/* Take m out of its room; an empty room is freed */
+void chat_room_leave(struct chat_member *m);
+
+#endif	/* _CHAT_ROOM_H */
@@ -0,0 +1,140 @@
+/*
+ * chat-server.h
+ *
+ * The insides of socket-server, shared between its common part
+ * [socket-server.c] and its I/O backends: epoll [chat-epoll.c] and
+ * io_uring [chat-uring.c].
+ *
+ * The common part owns connections, rooms and write queues. A
+ * backend owns the event loop of a worker: it accepts connections,
+ * gets what clients send into their frame buffers, and writes out
+ * their write queues when asked to.
+ *
+ */
+
+#ifndef _CHAT_SERVER_H
+#define _CHAT_SERVER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "chat-room.h"
+#include "chat-frame.h"
+#include "chat-mpsc.h"
+
+#define CHAT_CONSOLE_MAX 65536		/* console input read at a time, one message */
+#define CHAT_IOV_MAX	64		/* messages written per writev()/sendmsg() */
+
+struct chat_conn;
+struct chat_worker;
+struct chat_uring;
+struct chat_uring_conn;
+
+struct chat_backend {
+	const char *name;
+
+	/* Set up w, whose listening socket is ready; -1 if not possible here */
+	int (*init)(struct chat_worker *w);
+
+	/* Undo init, for a worker that has not run */
+	void (*fini)(struct chat_worker *w);
+
+	/* The event loop, never returns; pthread_create() style */
+	void *(*run)(void *w);
+
+	/* Start writing out the write queue of c */
+	void (*flush)(struct chat_conn *c);
+
+	/*
+	 * Stop all I/O on c, which is already out of its room and the
+	 * worker's list: put it on w->dead, now or once the backend is
+	 * done with it.
+	 */
+	void (*close)(struct chat_conn *c);
+};
+
+extern const struct chat_backend chat_epoll_backend;
+extern const struct chat_backend chat_uring_backend;
+
+struct chat_worker {
+	int id;
+	pthread_t thread;
+	int listen_fd;
+	int console;			/* reads stdin */
+	int efd;			/* eventfd, signalled when inbox has posts */
+	int wake;			/* efd signalled and not read yet */
+	struct chat_mpsc inbox;		/* chat_posts from the other workers */
+
+	const struct chat_backend *be;
+	int epfd;			/* epoll backend */
+	struct chat_uring *uring;	/* io_uring backend */
+
+	struct chat_conn *conns;
+
+	/*
+	 * A connection closed while handling one event may still appear
+	 * further down the same batch of events. Closed connections are
+	 * marked so and parked here, to be freed after the batch.
+	 */
+	struct chat_conn *dead;
+
+	/* Connections with new messages queued, flushed after every batch of events */
+	struct chat_conn *flush_list;
+};
+
+struct chat_conn {
+	struct chat_worker *w;		/* the only thread that touches it */
+	int fd;
+	int closed;
+	unsigned int id;		/* "Alice<id>" on the console */
+	char name[INET_ADDRSTRLEN + 8];	/* address:port, for the log */
+	struct chat_frame_rx rx;	/* what the client sent, in frames */
+
+	struct chat_wq wq;		/* messages not written yet */
+	unsigned long dropped;		/* messages that did not fit in wq */
+	int blocked;			/* the backend flushes wq by itself when it can */
+	struct chat_member member;	/* of the room the client is in */
+	int flush_pending;		/* on w->flush_list */
+	struct chat_conn *flush_next;
+
+	uint32_t events;		/* epoll backend: what epoll watches for */
+	struct chat_uring_conn *uring;	/* io_uring backend: operations in flight */
+
+	struct chat_conn *prev, *next;	/* all connections of w */
+};
+
+/* Insist until all of the data has been written */
+ssize_t insist_write(int fd, const void *buf, size_t cnt);
+
+/* A connection for a newly accepted fd, not started yet; NULL on ENOMEM */
+struct chat_conn *chat_conn_new(struct chat_worker *w, int fd);
+
+/* The backend is watching c: it joins the worker, and the lobby */
+void chat_conn_start(struct chat_conn *c);
+
+void chat_conn_close(struct chat_conn *c, const char *why);
+
+/* Close and free a connection the backend could not start */
+void chat_conn_free(struct chat_conn *c);
+
+/*
+ * Handle every complete message in the frame buffer of c; -1 if c
+ * got closed meanwhile.
+ */
+int chat_conn_parse(struct chat_conn *c);
+
+/* c needs its write queue flushed, at the end of this batch of events */
+void chat_conn_want_flush(struct chat_conn *c);
+
+/* Flush every connection that asked for it, then free the dead ones */
+void chat_flush_all(struct chat_worker *w);
+void chat_reap(struct chat_worker *w);
+
+/* Deliver what the other workers posted; efd has been read */
+void chat_inbox_drain(struct chat_worker *w);
+
+/* n bytes typed on the console; 0 at the end of its input */
+void chat_console_input(struct chat_worker *w, const char *buf, size_t n);
+
+#endif	/* _CHAT_SERVER_H */
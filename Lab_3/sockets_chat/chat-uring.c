@@ -0,0 +1,541 @@
+/*
+ * chat-uring.c
+ *
+ * The io_uring backend of socket-server [chat-server.h]
+ *
+ * Every worker has its own ring, set up with the raw system calls;
+ * no liburing. Instead of being told when a socket is ready and then
+ * making a system call for it, the worker keeps requests in flight:
+ *
+ *   - one multishot accept on its listening socket, which posts a
+ *     completion for every new connection;
+ *   - one multishot recv per connection, which picks a buffer from
+ *     the worker's provided-buffer ring for every chunk it receives;
+ *     the chunk is appended to the connection's frame buffer and the
+ *     ring buffer given back at once;
+ *   - for a connection with messages queued, a chain of up to
+ *     CHAT_URING_LINK sendmsg requests, IOSQE_IO_LINK'ed so that they
+ *     go out in order, each with up to CHAT_IOV_MAX messages;
+ *   - a read on its eventfd, and on stdin for worker 0.
+ *
+ * New requests are only queued while handling a batch of completions
+ * and all go in with the io_uring_enter() that waits for the next
+ * batch: a busy worker makes one system call per loop, however many
+ * messages it moves.
+ *
+ * The kernel needs to be 6.0 or newer, for multishot recv; the ring
+ * is set up with IORING_SETUP_SINGLE_ISSUER, which 6.0 introduced,
+ * so that an older kernel fails right there and the server falls
+ * back to epoll.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "chat-server.h"
+
+#define CHAT_URING_ENTRIES	4096	/* submission queue entries */
+#define CHAT_URING_CQ_ENTRIES	16384	/* completion queue entries */
+#define CHAT_URING_BUFS		1024	/* provided buffers, a power of 2 */
+#define CHAT_URING_BUF_SIZE	4096
+#define CHAT_URING_BGID		0	/* buffer group of the provided-buffer ring */
+#define CHAT_URING_LINK		4	/* sendmsg requests chained per connection */
+
+/* What a request is about, in the low bits of its user_data */
+enum {
+	CHAT_URING_ACCEPT,		/* worker */
+	CHAT_URING_INBOX,		/* worker */
+	CHAT_URING_STDIN,		/* worker */
+	CHAT_URING_RECV,		/* connection */
+	CHAT_URING_SEND,		/* connection */
+};
+#define CHAT_URING_OP_MASK	7UL
+
+struct chat_uring {
+	int fd;
+
+	/* Submission queue */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local;		/* our tail, not published yet */
+	struct io_uring_sqe *sqes;
+
+	/* Completion queue */
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz;
+
+	/* Provided buffers, for the multishot recvs */
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	char *bufs;
+	unsigned short br_tail;
+
+	uint64_t efd_val;
+	int efd_flags;			/* of w->efd, restored by fini */
+	char console[CHAT_CONSOLE_MAX];
+};
+
+struct chat_uring_conn {
+	unsigned int ops;		/* requests in flight on the connection */
+	int sends, sends_done;		/* sendmsg requests in the chain in flight */
+	int send_failed;
+	struct msghdr mh[CHAT_URING_LINK];
+	struct iovec iov[CHAT_URING_LINK][CHAT_IOV_MAX];
+	size_t bytes[CHAT_URING_LINK];
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+	unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline uint64_t chat_uring_data(void *p, unsigned int op)
+{
+	return (uint64_t)(uintptr_t)p | op;
+}
+
+/*
+ * Hand everything queued to the kernel, and wait for wait_nr
+ * completions. -1 only on errors other than EINTR, and EBUSY, which
+ * means the completion queue must be reaped first.
+ */
+static int chat_uring_submit(struct chat_uring *u, unsigned int wait_nr)
+{
+	unsigned int n;
+	int ret;
+
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	n = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	ret = sys_io_uring_enter(u->fd, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	if (ret < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+		return -1;
+	return 0;
+}
+
+/* Room for n more entries, submitting what is queued if needed */
+static void chat_uring_reserve(struct chat_uring *u, unsigned int n)
+{
+	while (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + n > u->sq_entries)
+		if (chat_uring_submit(u, 0) < 0) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+}
+
+static struct io_uring_sqe *chat_uring_sqe(struct chat_uring *u, int fd, uint8_t opcode,
+	uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	chat_uring_reserve(u, 1);
+	sqe = &u->sqes[u->sq_local++ & *u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = data;
+	return sqe;
+}
+
+/* Give buffer bid back to the kernel */
+static void chat_uring_buf_put(struct chat_uring *u, unsigned int bid)
+{
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (CHAT_URING_BUFS - 1)];
+
+	b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * CHAT_URING_BUF_SIZE);
+	b->len = CHAT_URING_BUF_SIZE;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static void chat_uring_arm_accept(struct chat_worker *w)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = chat_uring_sqe(w->uring, w->listen_fd, IORING_OP_ACCEPT,
+			     chat_uring_data(w, CHAT_URING_ACCEPT));
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+static void chat_uring_arm_read(struct chat_worker *w, int fd, void *buf, size_t len,
+	unsigned int op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = chat_uring_sqe(w->uring, fd, IORING_OP_READ, chat_uring_data(w, op));
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = (uint64_t)-1;	/* where the file is, stdin may be a pipe */
+}
+
+static void chat_uring_arm_recv(struct chat_conn *c)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = chat_uring_sqe(c->w->uring, c->fd, IORING_OP_RECV,
+			     chat_uring_data(c, CHAT_URING_RECV));
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = CHAT_URING_BGID;
+	c->uring->ops++;
+}
+
+/* A request on c is done; the last one hands a closed c over to be freed */
+static void chat_uring_put(struct chat_conn *c)
+{
+	if (--c->uring->ops == 0 && c->closed) {
+		c->next = c->w->dead;
+		c->w->dead = c;
+	}
+}
+
+static void chat_uring_close(struct chat_conn *c)
+{
+	/* Ends the multishot recv, fails the sends in flight */
+	shutdown(c->fd, SHUT_RDWR);
+	if (c->uring->ops == 0) {
+		c->next = c->w->dead;
+		c->w->dead = c;
+	}
+}
+
+/*
+ * Send what is queued for c: a chain of sendmsg requests, each with
+ * MSG_WAITALL so that the kernel finishes it before going on with the
+ * next. c is blocked until the whole chain is done.
+ */
+static void chat_uring_flush(struct chat_conn *c)
+{
+	struct chat_uring_conn *uc = c->uring;
+	struct io_uring_sqe *sqe, *prev = NULL;
+	unsigned int first = 0;
+	int i, n;
+
+	if (uc->sends || c->wq.count == 0)
+		return;
+
+	/* A chain split over two submissions is two chains, racing each other */
+	chat_uring_reserve(c->w->uring, CHAT_URING_LINK);
+
+	uc->sends_done = uc->send_failed = 0;
+	while (uc->sends < CHAT_URING_LINK && first < c->wq.count) {
+		n = chat_wq_iov(&c->wq, first, uc->iov[uc->sends], CHAT_IOV_MAX);
+		first += n;
+		for (uc->bytes[uc->sends] = 0, i = 0; i < n; i++)
+			uc->bytes[uc->sends] += uc->iov[uc->sends][i].iov_len;
+		memset(&uc->mh[uc->sends], 0, sizeof(uc->mh[0]));
+		uc->mh[uc->sends].msg_iov = uc->iov[uc->sends];
+		uc->mh[uc->sends].msg_iovlen = n;
+
+		sqe = chat_uring_sqe(c->w->uring, c->fd, IORING_OP_SENDMSG,
+				     chat_uring_data(c, CHAT_URING_SEND));
+		sqe->addr = (uint64_t)(uintptr_t)&uc->mh[uc->sends];
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		if (prev)
+			prev->flags |= IOSQE_IO_LINK;
+		prev = sqe;
+		uc->sends++;
+		uc->ops++;
+	}
+	c->blocked = 1;
+}
+
+static void chat_uring_sent(struct chat_conn *c, int res)
+{
+	struct chat_uring_conn *uc = c->uring;
+	int k = uc->sends_done++;
+
+	if (!uc->send_failed) {
+		if (res < 0 || res < uc->bytes[k]) {
+			/* The rest of the chain comes back with -ECANCELED */
+			uc->send_failed = 1;
+			if (!c->closed)
+				chat_conn_close(c, res < 0 ? strerror(-res) : "short send");
+		} else {
+			chat_wq_consume(&c->wq, res);
+		}
+	}
+
+	if (uc->sends_done == uc->sends) {
+		uc->sends = 0;
+		c->blocked = 0;
+		if (!c->closed && c->wq.count)
+			chat_conn_want_flush(c);
+	}
+	chat_uring_put(c);
+}
+
+static void chat_uring_received(struct chat_conn *c, struct io_uring_cqe *cqe)
+{
+	struct chat_uring *u = c->w->uring;
+	unsigned int bid;
+	size_t space, len;
+	char *p, *buf;
+	int res = cqe->res;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		/*
+		 * Into the frame buffer, parsing as it fills up, as it only
+		 * makes room once the frames in it are handled; the ring
+		 * buffer goes back right away.
+		 */
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = u->bufs + (size_t)bid * CHAT_URING_BUF_SIZE;
+		for (len = 0; !c->closed && res > 0 && len < res; len += space) {
+			if (!(space = chat_frame_rx_space(&c->rx, &p))) {
+				chat_conn_close(c, "out of memory");
+				break;
+			}
+			if (space > res - len)
+				space = res - len;
+			memcpy(p, buf + len, space);
+			chat_frame_rx_commit(&c->rx, space);
+			if (chat_conn_parse(c) < 0)
+				break;
+		}
+		chat_uring_buf_put(u, bid);
+	}
+
+	if (!c->closed) {
+		if (res == 0)
+			chat_conn_close(c, NULL);
+		else if (res < 0 && res != -ENOBUFS)
+			chat_conn_close(c, strerror(-res));
+	}
+
+	/* Out of buffers, or the kernel just stopped: ask again */
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		if (!c->closed)
+			chat_uring_arm_recv(c);
+		chat_uring_put(c);
+	}
+}
+
+static void chat_uring_accepted(struct chat_worker *w, struct io_uring_cqe *cqe)
+{
+	struct chat_conn *c;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		chat_uring_arm_accept(w);
+	if (cqe->res < 0) {
+		if (cqe->res != -ECONNABORTED && cqe->res != -EINTR)
+			fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+		return;
+	}
+
+	if (!(c = chat_conn_new(w, cqe->res)) || !(c->uring = calloc(1, sizeof(*c->uring)))) {
+		perror("calloc");
+		if (c)
+			chat_conn_free(c);
+		else
+			close(cqe->res);
+		return;
+	}
+	chat_uring_arm_recv(c);
+	chat_conn_start(c);
+}
+
+static void chat_uring_complete(struct chat_worker *w, struct io_uring_cqe *cqe)
+{
+	void *p = (void *)(uintptr_t)(cqe->user_data & ~CHAT_URING_OP_MASK);
+	struct chat_uring *u = w->uring;
+
+	switch (cqe->user_data & CHAT_URING_OP_MASK) {
+	case CHAT_URING_ACCEPT:
+		chat_uring_accepted(w, cqe);
+		break;
+	case CHAT_URING_INBOX:
+		if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN)
+			fprintf(stderr, "read: eventfd: %s\n", strerror(-cqe->res));
+		chat_inbox_drain(w);
+		chat_uring_arm_read(w, w->efd, &u->efd_val, sizeof(u->efd_val), CHAT_URING_INBOX);
+		break;
+	case CHAT_URING_STDIN:
+		if (cqe->res < 0) {
+			fprintf(stderr, "read: console: %s\n", strerror(-cqe->res));
+			break;
+		}
+		chat_console_input(w, u->console, cqe->res);
+		if (cqe->res > 0)
+			chat_uring_arm_read(w, 0, u->console, sizeof(u->console), CHAT_URING_STDIN);
+		break;
+	case CHAT_URING_RECV:
+		chat_uring_received(p, cqe);
+		break;
+	case CHAT_URING_SEND:
+		chat_uring_sent(p, cqe->res);
+		break;
+	}
+}
+
+static void chat_uring_fini(struct chat_worker *w)
+{
+	struct chat_uring *u = w->uring;
+
+	if (!u)
+		return;
+	if (u->fd >= 0)
+		close(u->fd);
+	if (u->sq_ring && u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_ring_sz);
+	if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_sz);
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, CHAT_URING_ENTRIES * sizeof(struct io_uring_sqe));
+	if (u->br && u->br != MAP_FAILED)
+		munmap(u->br, u->br_sz);
+	free(u->bufs);
+	fcntl(w->efd, F_SETFL, u->efd_flags);
+	free(u);
+	w->uring = NULL;
+}
+
+/*
+ * Set up the ring, disabled: with IORING_SETUP_SINGLE_ISSUER only
+ * the thread that enables it may submit, and that is the worker's,
+ * not this one. Registering the buffer ring here means a kernel
+ * without it is found out before any thread starts.
+ */
+static int chat_uring_init(struct chat_worker *w)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	struct chat_uring *u;
+	unsigned int i;
+	static const unsigned int flags[] = {
+		IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,	/* 6.1 */
+		IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN,		/* 6.0 */
+	};
+
+	if (!(u = w->uring = calloc(1, sizeof(*u))))
+		return -1;
+	u->fd = -1;
+	u->efd_flags = fcntl(w->efd, F_GETFL);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]) && u->fd < 0; i++) {
+		memset(&p, 0, sizeof(p));
+		p.flags = flags[i] | IORING_SETUP_R_DISABLED | IORING_SETUP_CQSIZE;
+		p.cq_entries = CHAT_URING_CQ_ENTRIES;
+		u->fd = sys_io_uring_setup(CHAT_URING_ENTRIES, &p);
+	}
+	if (u->fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_NODROP))
+		goto out;
+
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (u->cq_ring_sz > u->sq_ring_sz)
+		u->sq_ring_sz = u->cq_ring_sz;
+	u->sq_ring = u->cq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+				       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ring == MAP_FAILED || u->sqes == MAP_FAILED)
+		goto out;
+
+	u->sq_head = (unsigned int *)((char *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *)((char *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((char *)u->sq_ring + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	u->sq_local = *u->sq_tail;
+	/* Entry i of the queue is always sqes[i] */
+	for (i = 0; i < p.sq_entries; i++)
+		u->sq_array[i] = i;
+	u->cq_head = (unsigned int *)((char *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+	/* The provided-buffer ring, and the buffers in it */
+	u->br_sz = CHAT_URING_BUFS * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED || !(u->bufs = malloc(CHAT_URING_BUFS * CHAT_URING_BUF_SIZE)))
+		goto out;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries = CHAT_URING_BUFS;
+	reg.bgid = CHAT_URING_BGID;
+	if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto out;
+	for (i = 0; i < CHAT_URING_BUFS; i++)
+		chat_uring_buf_put(u, i);
+
+	/* Reads of the eventfd wait in the kernel, rather than fail with EAGAIN */
+	fcntl(w->efd, F_SETFL, u->efd_flags & ~O_NONBLOCK);
+	return 0;
+
+out:
+	chat_uring_fini(w);
+	return -1;
+}
+
+static void *chat_uring_run(void *arg)
+{
+	struct chat_worker *w = arg;
+	struct chat_uring *u = w->uring;
+	unsigned int head, tail;
+
+	if (sys_io_uring_register(u->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+		perror("io_uring_register: enable rings");
+		exit(1);
+	}
+	chat_uring_arm_accept(w);
+	chat_uring_arm_read(w, w->efd, &u->efd_val, sizeof(u->efd_val), CHAT_URING_INBOX);
+	if (w->console)
+		chat_uring_arm_read(w, 0, u->console, sizeof(u->console), CHAT_URING_STDIN);
+
+	for (;;) {
+		/* Everything queued since last time goes in with the wait */
+		if (chat_uring_submit(u, 1) < 0) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+
+		head = *u->cq_head;
+		tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+			chat_uring_complete(w, &u->cqes[head & *u->cq_mask]);
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+		chat_flush_all(w);
+		chat_reap(w);
+	}
+
+	/* This will never happen */
+	return NULL;
+}
+
+const struct chat_backend chat_uring_backend = {
+	.name	= "io_uring",
+	.init	= chat_uring_init,
+	.fini	= chat_uring_fini,
+	.run	= chat_uring_run,
+	.flush	= chat_uring_flush,
+	.close	= chat_uring_close,
+};
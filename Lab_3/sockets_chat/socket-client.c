@@ -3,6 +3,10 @@
  * Simple TCP/IP communication using sockets
  *
  * Vangelis Koukis <vkoukis@cslab.ece.ntua.gr>
+ *
+ * Messages are framed both ways [chat-frame.h]: what is typed is
+ * sent as one message per read() from stdin, and what comes from
+ * the server is printed one message at a time, whatever its size.
  */
 
 #include <stdio.h>
@@ -22,6 +26,9 @@
 #include <netinet/in.h>
 
 #include "socket-common.h"
+#include "chat-frame.h"
+
+#define CHAT_INPUT_MAX 65536	/* stdin read at a time, one message */
 
 /* Insist until all of the data has been written */
 ssize_t insist_write(int fd, const void *buf, size_t cnt)
@@ -45,8 +52,11 @@ int main(int argc, char *argv[])
 
 	char *hostname;
 	struct hostent *hp;
-	char input_buffer[100];
-	int socket_fd,polling,port;
+	static char input_buffer[CHAT_FRAME_HDR_MAX + CHAT_INPUT_MAX];
+	char *frame, *data, *p;
+	struct chat_frame_rx rx;
+	size_t space, len;
+	int socket_fd,polling,port,hdr,ret,stdin_open = 1;
 	ssize_t input_bytes;
 	struct sockaddr_in sa;
 	fd_set set_of_files_to_be_polled;
@@ -81,13 +91,15 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	fprintf(stderr, "Connected.\n");
+	chat_frame_rx_init(&rx, CHAT_FRAME_MAX);
 	FD_ZERO(&set_of_files_to_be_polled);
 	fprintf(stdout,"Alice: ");
 	fflush(stdout);
 	/* Read answer and write it to standard output */
 		for (;;) {
 			FD_SET(socket_fd,&set_of_files_to_be_polled);
-			FD_SET(0,&set_of_files_to_be_polled);
+			if (stdin_open)
+				FD_SET(0,&set_of_files_to_be_polled);
 			polling = select(socket_fd+1,&set_of_files_to_be_polled,NULL,NULL,NULL);
 			if((polling == -1)){
 				fprintf(stdout,"Error in select!");
@@ -95,7 +107,12 @@ int main(int argc, char *argv[])
 				exit(1);
 			}
 			if(FD_ISSET(socket_fd,&set_of_files_to_be_polled)){
-				input_bytes = read(socket_fd,input_buffer,sizeof(input_buffer));
+				/* Straight into the frame buffer, printed from there */
+				if (!(space = chat_frame_rx_space(&rx, &p))) {
+					fprintf(stderr, "\nOut of memory\n");
+					break;
+				}
+				input_bytes = read(socket_fd,p,space);
 				if (input_bytes <= 0) {
 				if (input_bytes < 0)
 					perror("read from remote peer failed");
@@ -103,29 +120,46 @@ int main(int argc, char *argv[])
 					fprintf(stderr, "\nBob went away\n");
 				break;
 				}
-				fprintf(stdout,"\nBob: ");
-				fflush(stdout);
-				if(insist_write(1,input_buffer,input_bytes) != input_bytes){
-					perror("Something went wrong when writing to the stdout!");
+				chat_frame_rx_commit(&rx, input_bytes);
+				while ((ret = chat_frame_next(&rx, &data, &len)) > 0) {
+					fprintf(stdout,"\n");
+					fflush(stdout);
+					if(insist_write(1,data,len) != len){
+						perror("Something went wrong when writing to the stdout!");
+					}
+					fprintf(stdout,"Alice: ");
+					fflush(stdout);
+				}
+				if (ret < 0) {
+					fprintf(stderr, "\nBad frame from the server\n");
+					break;
 				}
-				fprintf(stdout,"Alice: ");
-				fflush(stdout);
 			}
-			if(FD_ISSET(0,&set_of_files_to_be_polled)){
-				input_bytes = read(0,input_buffer,sizeof(input_buffer));
+			if(stdin_open && FD_ISSET(0,&set_of_files_to_be_polled)){
+				/* Leave room in front for the header of the frame */
+				input_bytes = read(0,input_buffer + CHAT_FRAME_HDR_MAX,CHAT_INPUT_MAX);
 				if(input_bytes < 0 ){
 					// If input from read less than input bytes 
 					perror("Something went wrong with the read!\n");
 					exit(1);
 				}
+				if (input_bytes == 0) {
+					/* Nothing more to say, but keep listening */
+					stdin_open = 0;
+					continue;
+				}
 				fprintf(stdout,"Alice: ");
 				fflush(stdout);
-				if(insist_write(socket_fd,input_buffer,input_bytes) != input_bytes){
+				hdr = chat_frame_hdr_len(input_bytes);
+				frame = input_buffer + CHAT_FRAME_HDR_MAX - hdr;
+				chat_varint_encode(frame, input_bytes);
+				if(insist_write(socket_fd,frame,hdr + input_bytes) != hdr + input_bytes){
 					perror("Something went wrong when writing to the stdout!");
 					
 				}	
 		}	
 	}
+	chat_frame_rx_destroy(&rx);
 	fprintf(stderr,"Done.\n");
 	fflush(stderr);
 	return 0;
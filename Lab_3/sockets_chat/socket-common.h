@@ -11,7 +11,7 @@
 
 /* Compile-time options */
 #define TCP_PORT    35001
-#define TCP_BACKLOG 5
+#define TCP_BACKLOG 1024	/* default; bursts of thousands of clients connecting */
 
 #define HELLO_THERE "Hello there!"
 
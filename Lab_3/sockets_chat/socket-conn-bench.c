@@ -0,0 +1,341 @@
+/*
+ * socket-conn-bench.c
+ * Connection scaling benchmark for the chat server
+ *
+ * Starts socket-server with its console on two pipes, then connects
+ * more and more clients to it: 1, 4, 16, ... up to -n. At every step
+ * it measures
+ *
+ *   connect/s   how fast the new clients got connected,
+ *   fan-out     the time from a line typed on the server's console
+ *               until the last client has received it,
+ *   inbound     the rate at which the console prints one message
+ *               sent by every client at once.
+ *
+ * Every client goes into a room of its own, so that what it sends
+ * reaches the console and nobody else.
+ *
+ * Arguments after "--" are passed on to the server, e.g. -t 4 to
+ * compare thread counts.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "socket-common.h"
+#include "chat-frame.h"
+#include "chat-room.h"
+
+#define BENCH_PIPE	((uint32_t)-1)	/* epoll tag of the server's stdout */
+
+struct bench_client {
+	int fd;
+	size_t got;			/* bytes of the current broadcast received */
+	size_t notices;			/* bytes of the notices of its rooms */
+};
+
+static struct bench_client *clients;
+static int nclients, epfd;
+static int srv_in, srv_out;		/* the server's stdin and stdout */
+static unsigned long marks;		/* '#' seen on the server's stdout */
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t spawn_server(char **argv)
+{
+	int in[2], out[2], null;
+	pid_t pid;
+
+	if (pipe(in) < 0 || pipe(out) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		dup2(in[0], 0);
+		dup2(out[1], 1);
+		/* One line per connection on stderr; not what we are measuring */
+		if ((null = open("/dev/null", O_WRONLY)) >= 0)
+			dup2(null, 2);
+		close(in[1]);
+		close(out[0]);
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(1);
+	}
+	close(in[0]);
+	close(out[1]);
+	srv_in = in[1];
+	srv_out = out[0];
+	fcntl(srv_out, F_SETFL, O_NONBLOCK);
+	return pid;
+}
+
+static int connect_one(void)
+{
+	int fd;
+	struct sockaddr_in sa;
+
+	if ((fd = socket(PF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(TCP_PORT);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Handle events until done() holds; -1 after a 10 s timeout */
+static int pump(int (*done)(size_t arg), size_t arg)
+{
+	int i, n;
+	char buf[4096], *p;
+	ssize_t r;
+	struct epoll_event ev[256];
+	double deadline = now_sec() + 10;
+
+	while (!done(arg)) {
+		if (now_sec() > deadline)
+			return -1;
+		n = epoll_wait(epfd, ev, 256, 100);
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.u32 == BENCH_PIPE) {
+				while ((r = read(srv_out, buf, sizeof(buf))) > 0)
+					for (p = buf; (p = memchr(p, '#', buf + r - p)); p++)
+						marks++;
+				continue;
+			}
+			while ((r = read(clients[ev[i].data.u32].fd, buf, sizeof(buf))) > 0)
+				clients[ev[i].data.u32].got += r;
+			if (r == 0) {
+				fprintf(stderr, "client %u: disconnected by the server\n", ev[i].data.u32);
+				exit(1);
+			}
+		}
+	}
+	return 0;
+}
+
+static int all_received(size_t len)
+{
+	int i;
+
+	for (i = 0; i < nclients; i++)
+		if (clients[i].got < len)
+			return 0;
+	return 1;
+}
+
+/* Clients from first on have both notices of their rooms */
+static int all_joined(size_t first)
+{
+	int i;
+
+	for (i = first; i < nclients; i++)
+		if (clients[i].got < clients[i].notices)
+			return 0;
+	return 1;
+}
+
+/* Bytes of the frame of a notice of the server */
+static size_t notice_len(const char *room)
+{
+	size_t len = strlen("* you are in \n") + strlen(room);
+
+	return chat_frame_hdr_len(len) + len;
+}
+
+/* Out of the lobby, into room "c<i>" */
+static int join_own_room(int i)
+{
+	char room[CHAT_ROOM_NAME_MAX], frame[CHAT_FRAME_HDR_MAX + CHAT_ROOM_NAME_MAX + 8];
+	int len, hdr;
+
+	snprintf(room, sizeof(room), "c%d", i);
+	len = snprintf(frame + CHAT_FRAME_HDR_MAX, sizeof(frame) - CHAT_FRAME_HDR_MAX,
+		"/join %s", room);
+	hdr = chat_frame_hdr_len(len);
+	chat_varint_encode(frame + CHAT_FRAME_HDR_MAX - hdr, len);
+	clients[i].notices = notice_len(CHAT_ROOM_DEFAULT) + notice_len(room);
+	return write(clients[i].fd, frame + CHAT_FRAME_HDR_MAX - hdr, hdr + len) == hdr + len ?
+		0 : -1;
+}
+
+static int all_printed(size_t want)
+{
+	return marks >= want;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s server] [-n max_clients] [-r rounds] [-- server args]\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fd, i, level, max = 4096, rounds = 20, r;
+	char *server = "./socket-server", **srv_argv;
+	char line[64];
+	struct rlimit rl;
+	struct epoll_event ev;
+	double t0, conn_dt, fan_sum, fan_max, in_dt;
+	int added;
+	size_t len;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "s:n:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			server = optarg;
+			break;
+		case 'n':
+			max = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max <= 0 || rounds <= 0)
+		usage(argv[0]);
+
+	/* getopt() stopped at "--", or at the end */
+	srv_argv = &argv[optind - 1];
+	srv_argv[0] = server;
+
+	signal(SIGPIPE, SIG_IGN);
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < max + 16)
+			fprintf(stderr, "warning: only %lu file descriptors\n",
+				(unsigned long)rl.rlim_cur);
+	}
+
+	clients = calloc(max, sizeof(*clients));
+	epfd = epoll_create1(0);
+	if (!clients || epfd < 0) {
+		perror("setup");
+		exit(1);
+	}
+
+	pid = spawn_server(srv_argv);
+	ev.events = EPOLLIN;
+	ev.data.u32 = BENCH_PIPE;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, srv_out, &ev);
+
+	/* Wait for the server to listen */
+	for (i = 0; (fd = connect_one()) < 0 || waitpid(pid, NULL, WNOHANG) != 0; i++) {
+		if (fd >= 0 || i == 200) {
+			fprintf(stderr, "%s: not accepting connections on port %d\n", server, TCP_PORT);
+			kill(pid, SIGTERM);
+			exit(1);
+		}
+		usleep(10000);
+	}
+	close(fd);
+
+	printf("%8s %12s %14s %14s %14s\n", "clients", "connect/s", "fan-out avg", "fan-out max",
+		"inbound msg/s");
+	for (level = 1; nclients < max; level = level * 4 < max ? level * 4 : max) {
+		/* Connect the new clients */
+		added = level - nclients;
+		conn_dt = now_sec();
+		for (; nclients < level; nclients++) {
+			if ((fd = connect_one()) < 0) {
+				perror("connect");
+				goto out;
+			}
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			clients[nclients].fd = fd;
+			ev.events = EPOLLIN;
+			ev.data.u32 = nclients;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				perror("epoll_ctl");
+				goto out;
+			}
+		}
+		conn_dt = now_sec() - conn_dt;
+
+		/* The notices must not count as part of the first broadcast */
+		for (i = level - added; i < nclients; i++)
+			if (join_own_room(i) < 0) {
+				perror("write");
+				goto out;
+			}
+		if (pump(all_joined, level - added) < 0) {
+			fprintf(stderr, "clients did not get into their rooms\n");
+			goto out;
+		}
+
+		/* Console to every client */
+		fan_sum = fan_max = 0;
+		for (r = 0; r < rounds; r++) {
+			len = snprintf(line, sizeof(line), "round %d of %d clients\n", r, nclients);
+			for (i = 0; i < nclients; i++)
+				clients[i].got = 0;
+			t0 = now_sec();
+			/* Framed, with "Bob: " in front, is what every client gets */
+			if (write(srv_in, line, len) != len ||
+			    pump(all_received, chat_frame_hdr_len(len + 5) + len + 5) < 0) {
+				fprintf(stderr, "broadcast to %d clients timed out\n", nclients);
+				goto out;
+			}
+			t0 = now_sec() - t0;
+			fan_sum += t0;
+			if (t0 > fan_max)
+				fan_max = t0;
+		}
+
+		/* Every client to the console */
+		marks = 0;
+		in_dt = now_sec();
+		for (i = 0; i < nclients; i++)
+			if (write(clients[i].fd, "\002#\n", 3) != 3)
+				perror("write");
+		if (pump(all_printed, nclients) < 0) {
+			fprintf(stderr, "only %lu of %d messages printed\n", marks, nclients);
+			goto out;
+		}
+		in_dt = now_sec() - in_dt;
+
+		printf("%8d %12.0f %11.1f us %11.1f us %14.0f\n", nclients,
+			added / conn_dt, fan_sum / rounds * 1e6, fan_max * 1e6, nclients / in_dt);
+		fflush(stdout);
+	}
+
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
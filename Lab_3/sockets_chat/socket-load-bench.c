@@ -0,0 +1,536 @@
+/*
+ * socket-load-bench.c
+ * Load generator and latency benchmark for the chat server
+ *
+ * Opens -c client connections from one process to a chat server that
+ * is already running, spreads them over -r rooms with /join, then for
+ * -d seconds sends messages of -s bytes at a total rate of -m per
+ * second, round robin over the clients.
+ *
+ * Every message carries the time it was sent, so whoever receives it
+ * can tell how long the server took to deliver it. Timestamps are
+ * CLOCK_MONOTONIC, so the latencies only mean something with the
+ * server on the same machine; its console output is not part of the
+ * measurement, best sent to /dev/null.
+ *
+ * Every second it prints the messages sent and delivered and the
+ * latency of that second; at the end the totals, latency percentiles
+ * and how many connections failed or went wrong.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "socket-common.h"
+#include "chat-frame.h"
+
+#define LOAD_CONNECTING	256		/* connects in flight at a time */
+#define LOAD_TIMEOUT	30		/* s, to get connected and into the rooms */
+#define LOAD_DRAIN	5		/* s, to wait for the last deliveries */
+#define LOAD_STAMP	"load "		/* payloads start with it, then the time sent */
+#define LOAD_SIZE_MIN	32		/* bytes, room for the stamp */
+
+/*
+ * Latencies in ns go into log-linear buckets: LOAD_SUB of them per
+ * power of two, so percentiles are off by at most 1/LOAD_SUB.
+ */
+#define LOAD_SUB_BITS	5
+#define LOAD_SUB	(1 << LOAD_SUB_BITS)
+#define LOAD_BUCKETS	((64 - LOAD_SUB_BITS + 1) * LOAD_SUB)
+
+enum load_state { LOAD_IDLE, LOAD_CONNECT, LOAD_JOIN, LOAD_READY, LOAD_DEAD };
+
+struct load_client {
+	int fd;
+	enum load_state state;
+	unsigned int room;
+	struct chat_frame_rx rx;
+	char *out;			/* a frame being written, [off, len) left */
+	size_t off, len;
+	uint32_t events;		/* what epoll watches for */
+};
+
+struct load_hist {
+	uint64_t count, sum, min, max;
+	uint64_t bucket[LOAD_BUCKETS];
+};
+
+static struct load_client *clients;
+static unsigned int *room_ready;	/* clients ready, per room */
+static int nclients, nrooms, epfd;
+static size_t msg_size;
+static struct sockaddr_in server;
+
+static struct load_hist total, second;
+static unsigned long conn_errors, disconnects, bad_frames;
+static unsigned long sent, skipped, delivered, expected;
+static unsigned long sent_sec, delivered_sec;
+static int connecting, joined, running;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+	int e;
+
+	if (v < LOAD_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return (e - LOAD_SUB_BITS + 1) * LOAD_SUB + ((v >> (e - LOAD_SUB_BITS)) & (LOAD_SUB - 1));
+}
+
+/* The middle of bucket i */
+static uint64_t hist_value(unsigned int i)
+{
+	int e;
+
+	if (i < LOAD_SUB)
+		return i;
+	e = i / LOAD_SUB + LOAD_SUB_BITS - 1;
+	return ((uint64_t)(LOAD_SUB + i % LOAD_SUB) << (e - LOAD_SUB_BITS)) +
+		((1ULL << (e - LOAD_SUB_BITS)) >> 1);
+}
+
+static void hist_add(struct load_hist *h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->bucket[hist_index(v)]++;
+}
+
+/* The latency p of the messages were delivered within, in ns */
+static uint64_t hist_pct(const struct load_hist *h, double p)
+{
+	uint64_t want, seen = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	want = p * h->count + 0.5;
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < LOAD_BUCKETS; i++)
+		if ((seen += h->bucket[i]) >= want)
+			break;
+	/* The ends are known exactly */
+	if (i == hist_index(h->max))
+		return h->max;
+	return hist_value(i) < h->min ? h->min : hist_value(i);
+}
+
+static void watch(struct load_client *c, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return;
+	ev.events = events;
+	ev.data.u32 = c - clients;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+		perror("epoll_ctl");
+	c->events = events;
+}
+
+static void client_fail(struct load_client *c, unsigned long *counter)
+{
+	if (c->state == LOAD_CONNECT)
+		connecting--;
+	if (c->state == LOAD_READY)
+		room_ready[c->room]--;
+	(*counter)++;
+	close(c->fd);
+	c->fd = -1;
+	c->state = LOAD_DEAD;
+}
+
+/* Write what is left of the frame being sent; -1 if c failed */
+static int client_flush(struct load_client *c)
+{
+	ssize_t n;
+
+	while (c->off < c->len) {
+		n = write(c->fd, c->out + c->off, c->len - c->off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			client_fail(c, &disconnects);
+			return -1;
+		}
+		c->off += n;
+	}
+	watch(c, EPOLLIN | (c->off < c->len ? EPOLLOUT : 0));
+	return 0;
+}
+
+/* Frame and send len bytes; -1 if the previous frame is not out yet */
+static int client_send(struct load_client *c, const char *data, size_t len)
+{
+	if (c->off < c->len)
+		return -1;
+	c->len = chat_varint_encode(c->out, len);
+	memcpy(c->out + c->len, data, len);
+	c->len += len;
+	c->off = 0;
+	return client_flush(c);
+}
+
+static void client_join(struct load_client *c)
+{
+	char cmd[32];
+
+	c->state = LOAD_JOIN;
+	client_send(c, cmd, snprintf(cmd, sizeof(cmd), "/join room%u", c->room));
+}
+
+static void client_connected(struct load_client *c)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	connecting--;
+	if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+		c->state = LOAD_IDLE;	/* connecting is already counted down */
+		client_fail(c, &conn_errors);
+		return;
+	}
+	client_join(c);
+}
+
+/* Start connecting the next few clients */
+static void connect_more(int *next)
+{
+	struct load_client *c;
+	struct epoll_event ev;
+
+	for (; *next < nclients && connecting < LOAD_CONNECTING; (*next)++) {
+		c = &clients[*next];
+		c->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (c->fd < 0) {
+			perror("socket");
+			c->state = LOAD_DEAD;
+			conn_errors++;
+			continue;
+		}
+		c->state = LOAD_CONNECT;
+		connecting++;
+		c->events = EPOLLOUT;
+		ev.events = c->events;
+		ev.data.u32 = *next;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+			perror("epoll_ctl");
+			client_fail(c, &conn_errors);
+			continue;
+		}
+		if (connect(c->fd, (struct sockaddr *)&server, sizeof(server)) == 0)
+			client_connected(c);
+		else if (errno != EINPROGRESS)
+			client_fail(c, &conn_errors);
+	}
+}
+
+/* A message from the server: the notice of the room joined, or someone's message */
+static void client_frame(struct load_client *c, const char *data, size_t len)
+{
+	char notice[48];
+	const char *p;
+	uint64_t t, now;
+	unsigned int i;
+
+	if (c->state == LOAD_JOIN) {
+		i = snprintf(notice, sizeof(notice), "* you are in room%u\n", c->room);
+		if (len == i && !memcmp(data, notice, len)) {
+			c->state = LOAD_READY;
+			room_ready[c->room]++;
+			joined++;
+		}
+		return;
+	}
+
+	/* "Alice<id>: load <ns> ..." */
+	if (!running || !(p = memmem(data, len < 32 ? len : 32, ": " LOAD_STAMP, 7)))
+		return;
+	p += 7;
+	for (t = 0, i = p - data; i < len && data[i] >= '0' && data[i] <= '9'; i++)
+		t = t * 10 + data[i] - '0';
+	now = now_ns();
+	if (t > now)
+		return;
+	hist_add(&total, now - t);
+	hist_add(&second, now - t);
+	delivered++;
+	delivered_sec++;
+}
+
+static void client_readable(struct load_client *c)
+{
+	char *p, *data;
+	size_t space, len;
+	ssize_t n;
+	int ret;
+
+	for (;;) {
+		if (!(space = chat_frame_rx_space(&c->rx, &p))) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		n = read(c->fd, p, space);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				client_fail(c, &disconnects);
+			return;
+		}
+		if (n == 0) {
+			client_fail(c, &disconnects);
+			return;
+		}
+		chat_frame_rx_commit(&c->rx, n);
+		while ((ret = chat_frame_next(&c->rx, &data, &len)) > 0)
+			client_frame(c, data, len);
+		if (ret < 0) {
+			client_fail(c, &bad_frames);
+			return;
+		}
+		if (n < space)
+			return;
+	}
+}
+
+/* Handle whatever happens within timeout ms */
+static void pump(int timeout)
+{
+	int i, n;
+	struct epoll_event ev[256];
+	struct load_client *c;
+
+	n = epoll_wait(epfd, ev, 256, timeout);
+	if (n < 0 && errno != EINTR) {
+		perror("epoll_wait");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		c = &clients[ev[i].data.u32];
+		if (c->state == LOAD_DEAD)
+			continue;
+		if (c->state == LOAD_CONNECT) {
+			client_connected(c);
+			continue;
+		}
+		if ((ev[i].events & EPOLLOUT) && client_flush(c) < 0)
+			continue;
+		if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			client_readable(c);
+	}
+}
+
+/* Send the messages due by now, one per client in turn */
+static void send_due(uint64_t due, char *msg)
+{
+	static int next;
+	struct load_client *c;
+	int len, tries;
+
+	while (sent + skipped < due) {
+		for (tries = 0; tries < nclients; tries++) {
+			c = &clients[next];
+			next = (next + 1) % nclients;
+			if (c->state == LOAD_READY)
+				break;
+		}
+		if (tries == nclients)
+			return;		/* nobody left */
+
+		/* Still writing the previous one: the server is not keeping up */
+		if (c->off < c->len) {
+			skipped++;
+			continue;
+		}
+
+		len = snprintf(msg, LOAD_SIZE_MIN, LOAD_STAMP "%" PRIu64 " ", now_ns());
+		memset(msg + len, '.', msg_size - len - 1);
+		msg[msg_size - 1] = '\n';
+		if (client_send(c, msg, msg_size) < 0)
+			continue;
+		sent++;
+		sent_sec++;
+		expected += room_ready[c->room] - 1;
+	}
+}
+
+static void print_second(int t)
+{
+	printf("%4ds %10lu %12lu %11.1f us %11.1f us %11.1f us\n", t, sent_sec, delivered_sec,
+		hist_pct(&second, 0.5) / 1e3, hist_pct(&second, 0.99) / 1e3,
+		second.max / 1e3);
+	fflush(stdout);
+	memset(&second, 0, sizeof(second));
+	sent_sec = delivered_sec = 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-c clients] [-r rooms] "
+		"[-m msgs/s] [-s size] [-d seconds]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, i, next, t, duration = 10;
+	char *host = "localhost", *msg;
+	int port = TCP_PORT;
+	double rate = 1000;
+	uint64_t start, end, deadline;
+	struct hostent *hp;
+	struct rlimit rl;
+
+	nclients = 1000;
+	nrooms = 10;
+	msg_size = 64;
+	while ((opt = getopt(argc, argv, "h:p:c:r:m:s:d:")) != -1) {
+		switch (opt) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			nclients = atoi(optarg);
+			break;
+		case 'r':
+			nrooms = atoi(optarg);
+			break;
+		case 'm':
+			rate = atof(optarg);
+			break;
+		case 's':
+			msg_size = atol(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || nclients <= 0 || nrooms <= 0 || rate <= 0 || duration <= 0 ||
+	    port <= 0 || port > 65535)
+		usage(argv[0]);
+	if (msg_size < LOAD_SIZE_MIN || msg_size > CHAT_FRAME_MAX / 2) {
+		fprintf(stderr, "-s: from %d to %d bytes\n", LOAD_SIZE_MIN, CHAT_FRAME_MAX / 2);
+		exit(1);
+	}
+
+	if (!(hp = gethostbyname(host))) {
+		fprintf(stderr, "DNS lookup failed for host %s\n", host);
+		exit(1);
+	}
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	memcpy(&server.sin_addr.s_addr, hp->h_addr, sizeof(struct in_addr));
+
+	signal(SIGPIPE, SIG_IGN);
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < nclients + 16)
+			fprintf(stderr, "warning: only %lu file descriptors\n",
+				(unsigned long)rl.rlim_cur);
+	}
+
+	clients = calloc(nclients, sizeof(*clients));
+	room_ready = calloc(nrooms, sizeof(*room_ready));
+	msg = malloc(msg_size);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (!clients || !room_ready || !msg || epfd < 0) {
+		perror("setup");
+		exit(1);
+	}
+	for (i = 0; i < nclients; i++) {
+		clients[i].fd = -1;
+		clients[i].room = i % nrooms;
+		chat_frame_rx_init(&clients[i].rx, CHAT_FRAME_MAX);
+		if (!(clients[i].out = malloc(CHAT_FRAME_HDR_MAX + msg_size))) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+
+	/* Everyone connected, and in their room */
+	start = now_ns();
+	deadline = start + LOAD_TIMEOUT * 1000000000ULL;
+	for (next = 0; joined + conn_errors + disconnects + bad_frames < nclients; ) {
+		connect_more(&next);
+		if (now_ns() > deadline) {
+			fprintf(stderr, "only %d of %d clients joined in %d s\n", joined, nclients,
+				LOAD_TIMEOUT);
+			break;
+		}
+		pump(100);
+	}
+	printf("%d clients in %d rooms in %.2f s, %lu failed to connect\n", joined, nrooms,
+		(now_ns() - start) / 1e9, conn_errors);
+	if (!joined)
+		exit(1);
+
+	/* The load */
+	printf("%5s %10s %12s %14s %14s %14s\n", "time", "sent", "delivered", "p50", "p99", "max");
+	running = 1;
+	start = now_ns();
+	end = start + duration * 1000000000ULL;
+	for (t = 1; now_ns() < end; ) {
+		send_due((now_ns() - start) / 1e9 * rate, msg);
+		pump(1);
+		if (now_ns() >= start + t * 1000000000ULL)
+			print_second(t++);
+	}
+	end = now_ns();
+
+	/* Whatever is still on its way */
+	deadline = end + LOAD_DRAIN * 1000000000ULL;
+	while (delivered < expected && now_ns() < deadline)
+		pump(10);
+
+	printf("\n");
+	printf("sent        %lu messages of %zu bytes, %.0f msg/s\n", sent, msg_size,
+		sent / ((end - start) / 1e9));
+	printf("delivered   %lu of %lu, %.0f msg/s, %.2f MB/s\n", delivered, expected,
+		delivered / ((end - start) / 1e9), delivered * msg_size / ((end - start) / 1e9) / 1e6);
+	printf("latency     min %.1f us, avg %.1f us, max %.1f us\n", total.min / 1e3,
+		total.count ? total.sum / total.count / 1e3 : 0, total.max / 1e3);
+	printf("            p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+		hist_pct(&total, 0.5) / 1e3, hist_pct(&total, 0.99) / 1e3,
+		hist_pct(&total, 0.999) / 1e3);
+	printf("errors      %lu failed to connect, %lu disconnected, %lu bad frames, "
+		"%lu sends skipped\n", conn_errors, disconnects, bad_frames, skipped);
+	return 0;
+}
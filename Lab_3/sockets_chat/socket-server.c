@@ -1,13 +1,46 @@
-
 /*
  * socket-server.c
  * Simple TCP/IP communication using sockets
  *
+ * An event-driven chat server: every socket is non-blocking and
+ * watched by an event loop, so any number of clients can be
+ * connected at once. The event loop is epoll's [chat-epoll.c] or
+ * io_uring's [chat-uring.c], chosen with -B; by default io_uring if
+ * the kernel has all it takes, epoll otherwise.
+ *
+ * The server runs -t worker threads, one per CPU by default. Every
+ * worker has its own listening socket on the chat port, thanks to
+ * SO_REUSEPORT, so the kernel spreads new connections over them; its
+ * own event loop; and its own connections, which no other thread
+ * touches. A message for a room goes to the members on the same
+ * worker directly, and to every other worker through a lock-free
+ * queue [chat-mpsc.h], with an eventfd to wake it up.
+ *
+ * Clients are in rooms, "lobby" to begin with; "/join <room>" moves
+ * a client to another one. Whatever a client says is fanned out to
+ * the other members of its room: the message is built once, in a
+ * reference-counted buffer [chat-room.h], and queued by pointer on
+ * every member's write queue. Queues are flushed once per event loop
+ * iteration, or when the socket can take more again. A client whose
+ * queue is full is disconnected, or with -d misses the messages that
+ * do not fit.
+ *
+ * The console is a participant, as before: whatever a client sends
+ * is printed on stdout under its name, whatever is typed on stdin is
+ * sent to every connected client, in any room. Worker 0 reads the
+ * console; the others print under the stdout lock.
+ *
+ * Messages are framed both ways [chat-frame.h]; one frame is one
+ * message, however TCP happens to cut it up. The sender's name is
+ * prepended to the payload of what is relayed.
+ *
  * Bampilis Georgios
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -15,18 +48,47 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "socket-common.h"
+#include "chat-server.h"
+
+#define CHAT_PREFIX_MAX	32		/* "Alice<id>: " prepended to relayed messages */
+#define CHAT_WQ_LIMIT	1024		/* default write queue limit, in messages */
+#define CHAT_WORKERS_MAX 256
+
+/* A message for the clients of another worker, in a room or all of them */
+struct chat_post {
+	struct chat_mpsc_node node;
+	struct chat_msg *msg;
+	char room[CHAT_ROOM_NAME_MAX];	/* "": everyone */
+};
+
+#define member_conn(m)	\
+	((struct chat_conn *)((char *)(m) - offsetof(struct chat_conn, member)))
+
+/* Write queue limit, and what to do when a client hits it */
+static unsigned int chat_wq_limit = CHAT_WQ_LIMIT;
+static int chat_drop_when_full;
+
+static int chat_backlog = TCP_BACKLOG;
+static int chat_nworkers;
+static struct chat_worker *chat_workers;
+
+/* Shared by the workers, updated atomically */
+static unsigned int chat_nconns, chat_next_id;
 
 /* Insist until all of the data has been written */
 ssize_t insist_write(int fd, const void *buf, size_t cnt)
 {
 	ssize_t ret;
 	size_t orig_cnt = cnt;
-	
+
 	while (cnt > 0) {
 	        ret = write(fd, buf, cnt);
 	        if (ret < 0)
@@ -38,123 +100,525 @@ ssize_t insist_write(int fd, const void *buf, size_t cnt)
 	return orig_cnt;
 }
 
-int main(void)
+struct chat_conn *chat_conn_new(struct chat_worker *w, int fd)
 {
-	char input_buffer[100];
-	char addrstr[INET_ADDRSTRLEN];
-	int socket_fd, client_fd,polling;
-	ssize_t input_bytes;
+	int one = 1;
 	socklen_t len;
 	struct sockaddr_in sa;
-	fd_set set_of_files_to_be_polled;
-	/* Make sure a broken connection doesn't kill us 
-	 Sigpipe gets triggered whenever a write fails
-	 with this command we ensure that sigpipe signal 
-	 is ignored.*/
-	signal(SIGPIPE, SIG_IGN);
+	struct chat_conn *c;
+	char addrstr[INET_ADDRSTRLEN];
 
-	/* Create TCP/IP socket, used as main chat channel 
-	SOCK_STREAM->Tcp connection used to make sure all
-	messages are sent succesfully
-	PF_INET->Same as AF_Inet (could be replaced)*/
-	if ((socket_fd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-		perror("Something went wrong when creating the socket!");
-		exit(1);
+	if (!(c = calloc(1, sizeof(*c))))
+		return NULL;
+	c->w = w;
+	c->fd = fd;
+	c->id = __atomic_add_fetch(&chat_next_id, 1, __ATOMIC_RELAXED);
+	chat_wq_init(&c->wq, chat_wq_limit);
+	chat_frame_rx_init(&c->rx, CHAT_FRAME_MAX - CHAT_PREFIX_MAX);
+
+	len = sizeof(sa);
+	if (getpeername(fd, (struct sockaddr *)&sa, &len) < 0 ||
+	    !inet_ntop(AF_INET, &sa.sin_addr, addrstr, sizeof(addrstr)))
+		strcpy(addrstr, "?");
+	snprintf(c->name, sizeof(c->name), "%s:%d", addrstr, ntohs(sa.sin_port));
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return c;
+}
+
+static void chat_conn_join(struct chat_conn *c, const char *name);
+
+void chat_conn_start(struct chat_conn *c)
+{
+	struct chat_worker *w = c->w;
+
+	c->next = w->conns;
+	if (w->conns)
+		w->conns->prev = c;
+	w->conns = c;
+	chat_conn_join(c, CHAT_ROOM_DEFAULT);
+
+	fprintf(stderr, "Incoming connection from %s, Alice%u on worker %d [%u connected]\n",
+		c->name, c->id, w->id,
+		__atomic_add_fetch(&chat_nconns, 1, __ATOMIC_RELAXED));
+	fflush(stderr);
+}
+
+void chat_conn_close(struct chat_conn *c, const char *why)
+{
+	fprintf(stderr, "\nAlice%u [%s] went away%s%s\n", c->id, c->name,
+		why ? ": " : "", why ? why : "");
+	if (c->dropped)
+		fprintf(stderr, "Alice%u missed %lu messages, write queue full\n",
+			c->id, c->dropped);
+	c->closed = 1;
+	chat_room_leave(&c->member);
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		c->w->conns = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	c->prev = c->next = NULL;
+	__atomic_sub_fetch(&chat_nconns, 1, __ATOMIC_RELAXED);
+
+	c->w->be->close(c);
+}
+
+void chat_conn_free(struct chat_conn *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	chat_wq_destroy(&c->wq);
+	chat_frame_rx_destroy(&c->rx);
+	free(c->uring);
+	free(c);
+}
+
+void chat_reap(struct chat_worker *w)
+{
+	struct chat_conn *c;
+
+	while ((c = w->dead)) {
+		w->dead = c->next;
+		chat_conn_free(c);
+	}
+}
+
+void chat_conn_want_flush(struct chat_conn *c)
+{
+	if (!c->flush_pending && !c->blocked) {
+		c->flush_pending = 1;
+		c->flush_next = c->w->flush_list;
+		c->w->flush_list = c;
+	}
+}
+
+/*
+ * Queue a message for a client. It is written at the end of this
+ * batch of events, along with whatever else gets queued until then;
+ * or when the socket can take more, if it is full.
+ */
+static void chat_conn_send(struct chat_conn *c, struct chat_msg *m)
+{
+	if (chat_wq_push(&c->wq, m) < 0) {
+		if (chat_drop_when_full) {
+			c->dropped++;
+			return;
+		}
+		chat_conn_close(c, "too slow, write queue full");
+		return;
+	}
+	chat_conn_want_flush(c);
+}
+
+void chat_flush_all(struct chat_worker *w)
+{
+	struct chat_conn *c;
+
+	while ((c = w->flush_list)) {
+		w->flush_list = c->flush_next;
+		c->flush_pending = 0;
+		if (!c->closed)
+			w->be->flush(c);
+	}
+}
+
+/* One frame, ready to be queued: prefix, then len bytes of data */
+static struct chat_msg *chat_msg_frame(const char *prefix, const char *data, size_t len)
+{
+	size_t plen = strlen(prefix);
+	int hdr = chat_frame_hdr_len(plen + len);
+	struct chat_msg *m = chat_msg_new(hdr + plen + len);
+
+	if (!m)
+		return NULL;
+	chat_varint_encode(m->data, plen + len);
+	memcpy(m->data + hdr, prefix, plen);
+	memcpy(m->data + hdr + plen, data, len);
+	return m;
+}
+
+/* A message to the client alone, e.g. the answer to a command */
+static void chat_conn_notice(struct chat_conn *c, const char *text)
+{
+	struct chat_msg *m = chat_msg_frame("", text, strlen(text));
+
+	if (!m)
+		return;
+	chat_conn_send(c, m);
+	chat_msg_put(m);
+}
+
+static void chat_conn_join(struct chat_conn *c, const char *name)
+{
+	char notice[CHAT_ROOM_NAME_MAX + 32];
+	struct chat_room *r = chat_room_lookup(name);
+
+	if (!r) {
+		chat_conn_notice(c, "* out of memory, staying where you are\n");
+		return;
+	}
+	chat_room_join(r, &c->member);
+	/* Members on other workers are not counted here, so don't say how many */
+	snprintf(notice, sizeof(notice), "* you are in %s\n", r->name);
+	chat_conn_notice(c, notice);
+}
+
+/* "/join <room>", alone in a message; returns 0 if data was not a command */
+static int chat_conn_command(struct chat_conn *c, char *data, size_t len)
+{
+	char name[CHAT_ROOM_NAME_MAX];
+	size_t i, n;
+
+	if (len < 6 || memcmp(data, "/join ", 6))
+		return 0;
+	for (i = 6, n = 0; i < len && !isspace(data[i]) && n < sizeof(name) - 1; i++)
+		name[n++] = data[i];
+	name[n] = '\0';
+	if (n == 0)
+		chat_conn_notice(c, "* usage: /join <room>\n");
+	else
+		chat_conn_join(c, name);
+	return 1;
+}
+
+/* Queue m for the members of room r on this worker, but one */
+static void chat_room_deliver(struct chat_room *r, struct chat_msg *m,
+	struct chat_member *except)
+{
+	struct chat_member *mb, *next;
+
+	for (mb = r->members; mb; mb = next) {
+		next = mb->next;
+		if (mb != except)
+			chat_conn_send(member_conn(mb), m);
+	}
+}
+
+static void chat_deliver_all(struct chat_worker *w, struct chat_msg *m)
+{
+	struct chat_conn *c, *next;
+
+	for (c = w->conns; c; c = next) {
+		next = c->next;
+		chat_conn_send(c, m);
+	}
+}
+
+/*
+ * Hand m to every other worker, for room or for everyone if room is
+ * NULL. Only the first post since a worker last drained its inbox
+ * costs a write() to its eventfd.
+ */
+static void chat_post(struct chat_worker *self, const char *room, struct chat_msg *m)
+{
+	static const uint64_t one = 1;
+	struct chat_worker *w;
+	struct chat_post *p;
+	int i;
+
+	for (i = 0; i < chat_nworkers; i++) {
+		w = &chat_workers[i];
+		if (w == self)
+			continue;
+		if (!(p = malloc(sizeof(*p)))) {
+			perror("malloc: post");
+			continue;
+		}
+		p->msg = chat_msg_get(m);
+		if (room)
+			strncpy(p->room, room, sizeof(p->room));
+		else
+			p->room[0] = '\0';
+		chat_mpsc_push(&w->inbox, &p->node);
+		if (!__atomic_exchange_n(&w->wake, 1, __ATOMIC_ACQ_REL))
+			if (write(w->efd, &one, sizeof(one)) != sizeof(one))
+				perror("write: eventfd");
+	}
+}
+
+void chat_inbox_drain(struct chat_worker *w)
+{
+	struct chat_room *r;
+	struct chat_post *p;
+	struct chat_mpsc_node *n;
+
+	/* Posts pushed from now on signal efd again */
+	__atomic_store_n(&w->wake, 0, __ATOMIC_SEQ_CST);
+
+	while ((n = chat_mpsc_pop(&w->inbox))) {
+		p = (struct chat_post *)((char *)n - offsetof(struct chat_post, node));
+		if (!p->room[0])
+			chat_deliver_all(w, p->msg);
+		else if ((r = chat_room_find(p->room)))
+			chat_room_deliver(r, p->msg, NULL);
+		chat_msg_put(p->msg);
+		free(p);
+	}
+}
+
+/* Send what a client said to the rest of its room, once for all of them */
+static void chat_room_broadcast(struct chat_conn *from, const char *data, size_t len)
+{
+	char prefix[CHAT_PREFIX_MAX];
+	struct chat_room *r = from->member.room;
+	struct chat_msg *m;
+
+	if (!r || (r->nmembers < 2 && chat_nworkers == 1))
+		return;
+	snprintf(prefix, sizeof(prefix), "Alice%u: ", from->id);
+	if (!(m = chat_msg_frame(prefix, data, len)))
+		return;
+
+	chat_post(from->w, r->name, m);
+	chat_room_deliver(r, m, &from->member);
+	chat_msg_put(m);
+}
+
+/* Everything a client says goes to its room, and to the console */
+static void chat_conn_message(struct chat_conn *c, char *data, size_t len)
+{
+	if (chat_conn_command(c, data, len))
+		return;
+
+	flockfile(stdout);
+	fprintf(stdout, "\nAlice%u: ", c->id);
+	fflush(stdout);
+	if (insist_write(1, data, len) != len)
+		perror("Something went wrong when writing to the stdout!");
+	fprintf(stdout, "Bob: ");
+	fflush(stdout);
+	funlockfile(stdout);
+
+	chat_room_broadcast(c, data, len);
+}
+
+int chat_conn_parse(struct chat_conn *c)
+{
+	char *data;
+	size_t len;
+	int ret;
+
+	while ((ret = chat_frame_next(&c->rx, &data, &len)) > 0) {
+		chat_conn_message(c, data, len);
+		if (c->closed)
+			return -1;
+	}
+	if (ret < 0) {
+		chat_conn_close(c, "bad frame");
+		return -1;
+	}
+	return 0;
+}
+
+/* Whatever is typed on the console goes to every client, one read() a message */
+void chat_console_input(struct chat_worker *w, const char *buf, size_t n)
+{
+	struct chat_msg *m;
+
+	if (n == 0) {
+		/* Keep serving the clients; the backend stops watching the console */
+		fprintf(stderr, "\nEnd of console input\n");
+		return;
+	}
+
+	fprintf(stdout, "Bob: ");
+	fflush(stdout);
+	if (!(m = chat_msg_frame("Bob: ", buf, n)))
+		return;
+	chat_post(w, NULL, m);
+	chat_deliver_all(w, m);
+	chat_msg_put(m);
+}
+
+/* Thousands of clients need thousands of file descriptors */
+static void raise_fd_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
 	}
-	fprintf(stderr, "TCP Socket created succesfully\n");
+}
 
-	/* Bind to a well-known port 
-	Memeset fills the mem_space of sa with 0
-	ipv4 protocol is defined
-	port 35001 used as sin port(in socket-common.h)
-	s_addr set to local_host */
+static void chat_bind(int fd)
+{
+	struct sockaddr_in sa;
+
+	/* Bind to a well-known port */
 	memset(&sa, 0, sizeof(sa));
 	sa.sin_family = AF_INET;
 	sa.sin_port = htons(TCP_PORT);
 	sa.sin_addr.s_addr = htonl(INADDR_ANY);
-	/*
-	Socket_fd is bound to 127.0.0.1
-	and the not well_known port(35001)
-	*/
-	if (bind(socket_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
 		perror("Something went wrong when binding the socket!");
 		exit(1);
 	}
-	fprintf(stderr, "Succesfully bound TCP socket to port %d!\n", TCP_PORT);
-	fflush(stderr);
-	/* Listen for incoming connections 
-	TCP_BACKLOG defines the length by which 
-	the queue of pending connections may grow 
-	in this case TCP_BACKLOG is set to 5
-	(in socket_common.h)*/
-	if (listen(socket_fd, TCP_BACKLOG) < 0) {
+}
+
+/*
+ * SO_REUSEPORT would just as well let the workers share the port
+ * with another server left running; binding once without it first
+ * fails if there is one.
+ */
+static void chat_port_check(void)
+{
+	int fd, one = 1;
+
+	if ((fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("Something went wrong when creating the socket!");
+		exit(1);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	chat_bind(fd);
+	close(fd);
+}
+
+/*
+ * A worker's own listening socket and eventfd. Runs in the main
+ * thread, so that a port already in use is an error before any
+ * thread starts.
+ */
+static void chat_worker_init(struct chat_worker *w, int id)
+{
+	int one = 1;
+
+	w->id = id;
+	w->epfd = -1;
+	chat_mpsc_init(&w->inbox);
+
+	/* Create TCP/IP socket, used as main chat channel */
+	if ((w->listen_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		perror("Something went wrong when creating the socket!");
+		exit(1);
+	}
+	setsockopt(w->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	/* Every worker binds the port; the kernel spreads connections over them */
+	if (setsockopt(w->listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("setsockopt: SO_REUSEPORT");
+		exit(1);
+	}
+	chat_bind(w->listen_fd);
+
+	/* Listen for incoming connections */
+	if (listen(w->listen_fd, chat_backlog) < 0) {
 		perror("listen");
 		exit(1);
 	}
 
-	/* Loop forever, accept()ing connections */
-	for (;;) {
-		fprintf(stderr, "Waiting for an incoming connection...\n");
-		fflush(stderr);
-		/* Accept an incoming connection */
-		len = sizeof(struct sockaddr_in);
-		if ((client_fd = accept(socket_fd, (struct sockaddr *)&sa, &len)) < 0) {
-			perror("accept");
-			exit(1);
+	if ((w->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		perror("eventfd");
+		exit(1);
+	}
+}
+
+/* Set up be on every worker; if one of them fails, undo the others */
+static int chat_backend_init(const struct chat_backend *be)
+{
+	int i, j;
+
+	for (i = 0; i < chat_nworkers; i++) {
+		chat_workers[i].be = be;
+		if (be->init(&chat_workers[i]) < 0) {
+			for (j = 0; j < i; j++)
+				be->fini(&chat_workers[j]);
+			return -1;
 		}
-		if (!inet_ntop(AF_INET, &sa.sin_addr, addrstr, sizeof(addrstr))) {
-			perror("could not format IP address");
-			exit(1);
+	}
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-B backend] [-t workers] [-b backlog] [-q limit] [-d]\n\n"
+		"  -B backend  auto, epoll or uring [default: auto, io_uring if the kernel\n"
+		"              has all it takes, epoll otherwise]\n"
+		"  -t workers  event loop threads [default: one per CPU]\n"
+		"  -b backlog  listen backlog of every worker [default: %d]\n"
+		"  -q limit    messages queued for a client before it is too slow [default: %d]\n"
+		"  -d          drop messages for a client that is too slow, instead of\n"
+		"              disconnecting it\n", argv0, TCP_BACKLOG, CHAT_WQ_LIMIT);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, opt;
+	const char *backend = "auto";
+
+	chat_nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "B:t:b:q:d")) != -1) {
+		switch (opt) {
+		case 'B':
+			backend = optarg;
+			break;
+		case 't':
+			chat_nworkers = atoi(optarg);
+			break;
+		case 'b':
+			chat_backlog = atoi(optarg);
+			break;
+		case 'q':
+			chat_wq_limit = atoi(optarg);
+			break;
+		case 'd':
+			chat_drop_when_full = 1;
+			break;
+		default:
+			usage(argv[0]);
 		}
-		fprintf(stderr, "Incoming connection from %s:%d\n",addrstr, ntohs(sa.sin_port));
-		fflush(stderr);
-		FD_ZERO(&set_of_files_to_be_polled);
-		fprintf(stdout,"Bob: ");
-		fflush(stdout);
-		/* We break out of the loop when the remote peer goes away */
-		for (;;) {
-			FD_SET(client_fd,&set_of_files_to_be_polled);
-			FD_SET(0,&set_of_files_to_be_polled);
-			polling = select(client_fd+1,&set_of_files_to_be_polled,NULL,NULL,NULL);
-			if((polling == -1)){
-				fprintf(stdout,"Error in select!");
-				fflush(stdout);
-				exit(1);
-			}
-
-			if(FD_ISSET(client_fd,&set_of_files_to_be_polled)){
-				input_bytes = read(client_fd,input_buffer,sizeof(input_buffer));
-				if (input_bytes <= 0) {
-				if (input_bytes < 0)
-					perror("read from remote peer failed");
-				else
-					fprintf(stderr, "\nAlice went away\n");
-				break;
-				}
-				fprintf(stdout,"\nAlice: ");
-				fflush(stdout);
-				if(insist_write(1,input_buffer,input_bytes) != input_bytes){
-						perror("Something went wrong when writing to the stdout!");
-				}
-				fprintf(stdout,"Bob: ");
-				fflush(stdout);
-			}
-			if(FD_ISSET(0,&set_of_files_to_be_polled)){
-				input_bytes = read(0,input_buffer,sizeof(input_buffer));
-				if(input_bytes < 0 ){
-					// If input from read less than input bytes 
-					perror("Something went wrong with the read!\n");
-					exit(1);
-				}
-				fprintf(stdout,"Bob: ");
-				fflush(stdout);
-				if(insist_write(client_fd,input_buffer,input_bytes) != input_bytes){
-						perror("Something went wrong when writing to the stdout!");
-				}
-			}
+	}
+	if (chat_nworkers <= 0 || chat_nworkers > CHAT_WORKERS_MAX || chat_backlog <= 0 ||
+	    chat_wq_limit == 0 || optind != argc)
+		usage(argv[0]);
+	if (strcmp(backend, "auto") && strcmp(backend, "epoll") && strcmp(backend, "uring"))
+		usage(argv[0]);
+
+	/* Make sure a broken connection doesn't kill us */
+	signal(SIGPIPE, SIG_IGN);
+	raise_fd_limit();
+
+	if (!(chat_workers = calloc(chat_nworkers, sizeof(*chat_workers)))) {
+		perror("calloc");
+		exit(1);
+	}
+	chat_port_check();
+	for (i = 0; i < chat_nworkers; i++)
+		chat_worker_init(&chat_workers[i], i);
+	/* The console belongs to worker 0, which is this thread */
+	chat_workers[0].console = 1;
+
+	if (strcmp(backend, "epoll") && chat_backend_init(&chat_uring_backend) == 0) {
+		backend = chat_uring_backend.name;
+	} else {
+		if (!strcmp(backend, "uring")) {
+			fprintf(stderr, "io_uring backend not available\n");
+			exit(1);
 		}
+		if (!strcmp(backend, "auto"))
+			fprintf(stderr, "io_uring not available, falling back to epoll\n");
+		if (chat_backend_init(&chat_epoll_backend) < 0)
+			exit(1);
+		backend = chat_epoll_backend.name;
 	}
+	fprintf(stderr, "%d %s workers listening on TCP port %d, backlog %d\n",
+		chat_nworkers, backend, TCP_PORT, chat_backlog);
+
+	for (i = 1; i < chat_nworkers; i++)
+		if ((errno = pthread_create(&chat_workers[i].thread, NULL, chat_workers[i].be->run,
+					    &chat_workers[i]))) {
+			perror("pthread_create");
+			exit(1);
+		}
+
+	fprintf(stderr, "Waiting for incoming connections...\n");
+	fprintf(stdout, "Bob: ");
+	fflush(stdout);
+
+	chat_workers[0].be->run(&chat_workers[0]);
+
 	/* This will never happen */
 	return 1;
 }
-